@@ -0,0 +1,2401 @@
+/*
+ * Description: libfsa: reading, compiling and running finite automata, behind the Automaton and Matcher interface of
+ *              fsa.h. The engines themselves are shared with the simulator's command line through fsa_internal.h.
+ */
+
+#include "fsa.h"
+#include "fsa_internal.h"
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <functional>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace fsa {
+namespace internal {
+
+const std::string epsilon_symbol = "ε";
+
+
+/*
+ * Description: Creates an empty set able to hold the dense state indices [0, @state_count).
+ * Parameters:
+ *    @size_t state_count : The number of states in the automaton.
+ */
+StateSet make_state_set(size_t state_count) {
+  StateSet set;
+  set.words.assign( ( state_count + 63 ) / 64, 0 );
+  return set;
+}
+
+void state_set_insert(StateSet &set, int index) {
+  set.words[ index >> 6 ] |= uint64_t( 1 ) << ( index & 63 );
+}
+
+bool state_set_contains(const StateSet &set, int index) {
+  return ( set.words[ index >> 6 ] >> ( index & 63 ) ) & 1;
+}
+
+void state_set_clear(StateSet &set) {
+  std::fill( set.words.begin(), set.words.end(), 0 );
+}
+
+bool state_set_intersects(const StateSet &lhs, const StateSet &rhs) {
+  for ( size_t w = 0; w < lhs.words.size(); w++ ) if ( lhs.words[ w ] & rhs.words[ w ] ) return true;
+  return false;
+}
+
+
+/*
+ * Description: Calls @visit with the dense index of every state in the bitset of @word_count @words, in ascending
+ *              order.
+ */
+template<typename Visitor>
+void for_each_state(const uint64_t *words, size_t word_count, Visitor visit) {
+  for ( size_t w = 0; w < word_count; w++ ) {
+    uint64_t word = words[ w ];
+    while ( word ) {
+      visit( static_cast<int>(w * 64 + __builtin_ctzll( word )) );
+      word &= word - 1;
+    }
+  }
+}
+
+template<typename Visitor>
+void for_each_state(const StateSet &set, Visitor visit) {
+  for_each_state( set.words.data(), set.words.size(), visit );
+}
+
+
+/*
+ * Description: Maps the file open as @fd into memory, hinting that it will be read front to back (and, where the
+ *              kernel supports it, in huge pages). Returns false, leaving @mapped empty, if @fd is not a non-empty
+ *              regular file or the mapping fails, in which case the caller falls back to read().
+ */
+bool map_file(
+        int fd,
+        MappedFile &mapped
+) {
+  struct stat status;
+  if ( fstat( fd, &status ) != 0 || !S_ISREG( status.st_mode ) || status.st_size <= 0 ) return false;
+
+  void *data = mmap( nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, fd, 0 );
+  if ( data == MAP_FAILED ) return false;
+  madvise( data, static_cast<size_t>(status.st_size), MADV_SEQUENTIAL );
+#ifdef MADV_HUGEPAGE
+  madvise( data, static_cast<size_t>(status.st_size), MADV_HUGEPAGE );
+#endif
+
+  mapped.data = static_cast<const char *>(data);
+  mapped.size = static_cast<size_t>(status.st_size);
+  return true;
+}
+
+void unmap_file(MappedFile &mapped) {
+  if ( mapped.data ) munmap( const_cast<char *>(mapped.data), mapped.size );
+  mapped = MappedFile();
+}
+
+
+/*
+ * Description: Parses @field, an optionally signed decimal number of any length that fits an int, into @id. Returns
+ *              false if @field is anything else.
+ */
+bool parse_id(std::string_view field, int &id) {
+  const bool negative = !field.empty() && field.front() == '-';
+  if ( negative ) field.remove_prefix( 1 );
+  if ( field.empty() ) return false;
+
+  int64_t value = 0;
+  for ( const char c : field ) {
+    if ( c < '0' || c > '9' ) return false;
+    value = value * 10 + ( c - '0' );
+    if ( value > int64_t( 1 ) << 31 ) return false;
+  }
+  if ( negative ) value = -value;
+  if ( value > INT32_MAX ) return false;
+
+  id = static_cast<int>(value);
+  return true;
+}
+
+
+/*
+ * What parse_specification() reads from one piece of a specification, with states still named by their ids. Pieces
+ * are parsed independently, possibly on different threads, and then merged in file order by build_automaton().
+ */
+struct SpecificationPiece {
+    std::vector<int> ids;                 // Every id named in the piece, in order of first appearance.
+    std::unordered_set<int> seen_ids;
+    std::vector<State> state_lines;
+    std::vector<Transition> transitions;  // Source and target are ids; symbols past 255 index symbols.
+    std::vector<std::string> symbols;
+    size_t error_line = 0;                // Line of the piece, from 1, that is malformed; 0 if none.
+    std::string error_text;
+};
+
+void note_id(SpecificationPiece &piece, int id) {
+  if ( piece.seen_ids.insert( id ).second ) piece.ids.push_back( id );
+}
+
+
+/*
+* Author:      Jacob Berg
+* Date:        February 12, 2020 @ 6:32PM
+* Description: Records the state @id, read from a state line, as a start and/or accept state. State lines will only
+ *             consist of start or accept states.
+*/
+void handle_state_line(
+        SpecificationPiece &piece,
+        int id,
+        bool is_start,
+        bool is_accept
+) {
+  State new_state;
+  new_state.id = id;
+  new_state.is_start = is_start;
+  new_state.is_accept = is_accept;
+
+  note_id( piece, id );
+  piece.state_lines.push_back( new_state );
+}
+
+
+/*
+ * Author:      Jacob Berg
+ * Date:        February 12, 2020 @ 11:43PM
+ * Description: Records the transition from @begin_state_arg to @end_state_arg on @symbol_arg, read from a transition
+ *              line. Either state becomes a part of the automaton's states if it is not one already.
+*/
+void handle_transition_line(
+        SpecificationPiece &piece,
+        int begin_state_arg,
+        std::string_view symbol_arg,
+        int end_state_arg
+) {
+  Transition transition;
+  transition.source = begin_state_arg;
+  transition.target = end_state_arg;
+
+  if ( symbol_arg.size() == 1 ) {
+    transition.symbol = static_cast<unsigned char>(symbol_arg.front());
+  } else {
+    const std::string symbol = symbol_arg == "epsilon" ? epsilon_symbol : std::string( symbol_arg );
+    const auto itr = std::find( piece.symbols.begin(), piece.symbols.end(), symbol );
+    transition.symbol = 256 + static_cast<uint32_t>(itr - piece.symbols.begin());
+    if ( itr == piece.symbols.end() ) piece.symbols.push_back( symbol );
+  }
+
+  note_id( piece, begin_state_arg );
+  note_id( piece, end_state_arg );
+  piece.transitions.push_back( transition );
+}
+
+
+/*
+ * Description: Parses the specification text [@begin, @end) into @piece in a single pass, with no copies of its
+ *              lines. Each line holds tab-separated fields:
+ *                  state       ID  [start]  [accept]
+ *                  transition  FROM  SYMBOL  TO
+ *              where ids are decimal numbers of any length. Blank lines and lines of any other kind are skipped.
+ *              Parsing stops at the first malformed state or transition line, which is noted in @piece.
+ */
+void parse_specification(
+        const char *begin,
+        const char *end,
+        SpecificationPiece &piece
+) {
+  const int max_fields = 5;
+  size_t line_number = 0;
+
+  for ( const char *line = begin; line < end; ) {
+    const char *newline = static_cast<const char *>(std::memchr( line, '\n', end - line ));
+    const char *line_end = newline ? newline : end;
+    const char *next_line = newline ? newline + 1 : end;
+    line_number++;
+    if ( line_end > line && line_end[ -1 ] == '\r' ) line_end--;
+    while ( line < line_end && ( *line == ' ' || *line == '\t' ) ) line++;
+
+    std::string_view fields[ max_fields ];
+    int field_count = 0;
+    for ( const char *field = line; field <= line_end && field_count < max_fields; field_count++ ) {
+      const char *tab = static_cast<const char *>(std::memchr( field, '\t', line_end - field ));
+      const char *field_end = tab ? tab : line_end;
+      fields[ field_count ] = std::string_view( field, field_end - field );
+      field = field_end + 1;
+    }
+
+    bool valid = true;
+    int id = 0, target = 0;
+    if ( line == line_end ) {
+      //A blank line.
+    } else if ( fields[ 0 ] == "state" ) {
+      bool is_start = false, is_accept = false;
+      for ( int field = 2; field < field_count; field++ ) {
+        if ( fields[ field ] == "start" ) is_start = true;
+        if ( fields[ field ] == "accept" ) is_accept = true;
+      }
+      valid = field_count >= 2 && parse_id( fields[ 1 ], id );
+      if ( valid ) handle_state_line( piece, id, is_start, is_accept );
+    } else if ( fields[ 0 ] == "transition" ) {
+      valid = field_count >= 4 && parse_id( fields[ 1 ], id ) && !fields[ 2 ].empty() &&
+              parse_id( fields[ 3 ], target );
+      if ( valid ) handle_transition_line( piece, id, fields[ 2 ], target );
+    }
+
+    if ( !valid ) {
+      piece.error_line = line_number;
+      piece.error_text.assign( line, line_end );
+      return;
+    }
+    line = next_line;
+  }
+}
+
+
+/*
+ * Description: Returns the dense index of the state @id, appending a new state (neither start nor accept) if the
+ *              automaton has none yet. Each id is looked up once in a hash table, so building an automaton takes
+ *              time linear in the size of its specification.
+ */
+int find_or_add_state(
+        Automaton &automaton,
+        int id
+) {
+  const auto found = automaton.state_index.emplace( id, static_cast<int>(automaton.state_ids.size()) );
+  if ( found.second ) automaton.state_ids.push_back( id );
+  return found.first->second;
+}
+
+
+/*
+ * Description: Calls @work( worker ) for every worker in [0, @thread_count), each on its own thread but the first,
+ *              which runs on the calling thread, and waits for all of them.
+ */
+void run_workers(
+        size_t thread_count,
+        const std::function<void(size_t)> &work
+) {
+  std::vector<std::thread> workers;
+  for ( size_t worker = 1; worker < thread_count; worker++ ) workers.emplace_back( work, worker );
+  work( 0 );
+  for ( auto &worker : workers ) worker.join();
+}
+
+
+/*
+ * Description: Sorts @transitions by (source, symbol) on @thread_count threads with a least-significant-digit radix
+ *              sort. Every pass is stable, so the targets of each (source, symbol) pair keep the order they were
+ *              read in. In a pass each thread counts the digits of its own slice, and the counts are then laid out
+ *              digit-major, thread-minor, so that every thread scatters its slice to a range of its own.
+ */
+void sort_transitions(
+        std::vector<Transition> &transitions,
+        size_t state_count,
+        uint32_t symbol_bound,
+        size_t thread_count
+) {
+  const int digit_bits = 11;
+  const size_t radix = size_t( 1 ) << digit_bits;
+  const size_t count = transitions.size();
+  const uint64_t max_key = state_count * static_cast<uint64_t>(symbol_bound);
+  if ( count < 2 || max_key < 2 ) return;
+
+  thread_count = std::max( size_t( 1 ), std::min( thread_count, count / radix ) );
+  const size_t slice = ( count + thread_count - 1 ) / thread_count;
+  std::vector<Transition> sorted( count );
+  std::vector<size_t> positions( thread_count * radix );
+
+  for ( int shift = 0; shift < 64 && ( ( max_key - 1 ) >> shift ) != 0; shift += digit_bits ) {
+    const auto digit = [&](const Transition &transition) {
+      const uint64_t key = static_cast<uint64_t>(transition.source) * symbol_bound + transition.symbol;
+      return static_cast<size_t>(( key >> shift ) & ( radix - 1 ));
+    };
+
+    std::fill( positions.begin(), positions.end(), 0 );
+    run_workers( thread_count, [&](size_t worker) {
+      const size_t first = std::min( count, worker * slice ), last = std::min( count, first + slice );
+      for ( size_t i = first; i < last; i++ ) positions[ worker * radix + digit( transitions[ i ] ) ]++;
+    } );
+
+    size_t position = 0;
+    for ( size_t bucket = 0; bucket < radix; bucket++ ) {
+      for ( size_t worker = 0; worker < thread_count; worker++ ) {
+        const size_t bucket_count = positions[ worker * radix + bucket ];
+        positions[ worker * radix + bucket ] = position;
+        position += bucket_count;
+      }
+    }
+
+    run_workers( thread_count, [&](size_t worker) {
+      const size_t first = std::min( count, worker * slice ), last = std::min( count, first + slice );
+      for ( size_t i = first; i < last; i++ ) sorted[ positions[ worker * radix + digit( transitions[ i ] ) ]++ ] =
+              transitions[ i ];
+    } );
+    transitions.swap( sorted );
+  }
+}
+
+
+/*
+ * Description: Merges the @pieces of a specification, in file order, into @automaton. States get dense indices in
+ *              order of first appearance and symbols their final codes, exactly as if the file had been read as one
+ *              piece; then every piece's transitions are renamed on a thread of their own and all of them sorted
+ *              into the CSR layout of Automaton::transitions.
+ */
+void build_automaton(
+        std::vector<SpecificationPiece> &pieces,
+        size_t thread_count,
+        Automaton &automaton
+) {
+  std::vector<std::vector<uint32_t> > symbol_codes( pieces.size() );
+  std::vector<size_t> first_transition( pieces.size() + 1, 0 );
+
+  for ( size_t i = 0; i < pieces.size(); i++ ) {
+    SpecificationPiece &piece = pieces[ i ];
+    for ( const int id : piece.ids ) find_or_add_state( automaton, id );
+    for ( const auto &symbol : piece.symbols ) {
+      auto itr = std::find( automaton.symbols.begin(), automaton.symbols.end(), symbol );
+      symbol_codes[ i ].push_back( 256 + static_cast<uint32_t>(itr - automaton.symbols.begin()) );
+      if ( itr == automaton.symbols.end() ) automaton.symbols.push_back( symbol );
+    }
+    first_transition[ i + 1 ] = first_transition[ i ] + piece.transitions.size();
+    piece.ids.clear();
+    piece.seen_ids.clear();
+  }
+
+  automaton.transitions.resize( first_transition.back() );
+  run_workers( pieces.size(), [&](size_t i) {
+    Transition *transition = &automaton.transitions[ first_transition[ i ] ];
+    for ( const auto &read : pieces[ i ].transitions ) {
+      transition->source = automaton.state_index.find( read.source )->second;
+      transition->target = automaton.state_index.find( read.target )->second;
+      transition->symbol = read.symbol < 256 ? read.symbol : symbol_codes[ i ][ read.symbol - 256 ];
+      transition++;
+    }
+    std::vector<Transition>().swap( pieces[ i ].transitions );
+  } );
+
+  const size_t state_count = automaton.state_ids.size();
+  automaton.start_states = make_state_set( state_count );
+  automaton.accept_states = make_state_set( state_count );
+  for ( const auto &piece : pieces ) {
+    for ( const State &line : piece.state_lines ) {
+      const int index = automaton.state_index.find( line.id )->second;
+      if ( line.is_start ) state_set_insert( automaton.start_states, index );
+      if ( line.is_accept ) state_set_insert( automaton.accept_states, index );
+    }
+  }
+  //From here on states are only named by their dense indices.
+  std::unordered_map<int, int>().swap( automaton.state_index );
+
+  sort_transitions( automaton.transitions, state_count, 256 + static_cast<uint32_t>(automaton.symbols.size()),
+                    thread_count );
+
+  automaton.transition_offsets.assign( state_count + 1, 0 );
+  for ( const auto &transition : automaton.transitions ) automaton.transition_offsets[ transition.source + 1 ]++;
+  for ( size_t index = 0; index < state_count; index++ )
+    automaton.transition_offsets[ index + 1 ] += automaton.transition_offsets[ index ];
+}
+
+
+/*
+ * Description: Reads the automaton specification @file_name into @automaton. The file is mapped and tokenized in
+ *              place; anything that cannot be mapped, such as a pipe, is read into memory first. A large file is
+ *              split at line boundaries into @thread_count pieces that are parsed in parallel. Returns false,
+ *              with the reason in @error, if the file cannot be opened or a state or transition line is malformed.
+ */
+bool parse_file(
+        const std::string &file_name,
+        size_t thread_count,
+        Automaton &automaton,
+        std::string &error
+) {
+  const size_t min_piece = size_t( 1 ) << 20;
+  const int fd = open( file_name.c_str(), O_RDONLY );
+  if ( fd < 0 ) {
+    error = "Failure in opening " + file_name + ": " + strerror( errno );
+    return false;
+  }
+
+  MappedFile mapped;
+  std::string text;
+  if ( !map_file( fd, mapped ) ) {
+    char buffer[ 1 << 16 ];
+    ssize_t count;
+    while ( ( count = read( fd, buffer, sizeof( buffer ) ) ) > 0 || ( count < 0 && errno == EINTR ) )
+      if ( count > 0 ) text.append( buffer, count );
+  }
+  close( fd );
+  const char *begin = mapped.data ? mapped.data : text.data();
+  const char *end = mapped.data ? mapped.data + mapped.size : text.data() + text.size();
+
+  //Each piece but the first starts just after the first newline at or past its share of the file.
+  const size_t length = static_cast<size_t>(end - begin);
+  const size_t piece_count = std::max( size_t( 1 ), std::min( thread_count, length / min_piece ) );
+  std::vector<const char *> bounds( 1, begin );
+  for ( size_t i = 1; i < piece_count; i++ ) {
+    const char *bound = std::max( bounds.back(), begin + i * ( length / piece_count ) );
+    const char *newline = static_cast<const char *>(std::memchr( bound, '\n', end - bound ));
+    bounds.push_back( newline ? newline + 1 : end );
+  }
+  bounds.push_back( end );
+
+  std::vector<SpecificationPiece> pieces( piece_count );
+  run_workers( piece_count, [&](size_t i) { parse_specification( bounds[ i ], bounds[ i + 1 ], pieces[ i ] ); } );
+
+  for ( size_t i = 0; i < piece_count; i++ ) {
+    if ( !pieces[ i ].error_line ) continue;
+    const size_t line_number = std::count( begin, bounds[ i ], '\n' ) + pieces[ i ].error_line;
+    error = "Malformed line " + std::to_string( line_number ) + " of " + file_name + ": " + pieces[ i ].error_text;
+    unmap_file( mapped );
+    return false;
+  }
+
+  build_automaton( pieces, thread_count, automaton );
+  unmap_file( mapped );
+  return true;
+}
+
+
+/*
+ * The bitset kernels of the frontier engine's hot loop: OR-ing a successor bitset into the next frontier, testing a
+ * frontier for emptiness, and testing it against the accept mask. select_simd_kernels() picks the widest variant
+ * the CPU supports at startup; the scalar variant is the fallback everywhere else.
+ */
+struct SimdKernels {
+    const char *name;
+    void (*or_into)(uint64_t *destination, const uint64_t *source, size_t words);
+    bool (*any)(const uint64_t *words, size_t count);
+    bool (*intersects)(const uint64_t *lhs, const uint64_t *rhs, size_t words);
+};
+
+void scalar_or_into(uint64_t *destination, const uint64_t *source, size_t words) {
+  for ( size_t w = 0; w < words; w++ ) destination[ w ] |= source[ w ];
+}
+
+bool scalar_any(const uint64_t *words, size_t count) {
+  for ( size_t w = 0; w < count; w++ ) if ( words[ w ] ) return true;
+  return false;
+}
+
+bool scalar_intersects(const uint64_t *lhs, const uint64_t *rhs, size_t words) {
+  for ( size_t w = 0; w < words; w++ ) if ( lhs[ w ] & rhs[ w ] ) return true;
+  return false;
+}
+
+#if defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) )
+__attribute__((target("sse2")))
+void sse2_or_into(uint64_t *destination, const uint64_t *source, size_t words) {
+  size_t w = 0;
+  for ( ; w + 2 <= words; w += 2 ) {
+    const __m128i merged = _mm_or_si128( _mm_loadu_si128( reinterpret_cast<const __m128i *>(destination + w) ),
+                                         _mm_loadu_si128( reinterpret_cast<const __m128i *>(source + w) ) );
+    _mm_storeu_si128( reinterpret_cast<__m128i *>(destination + w), merged );
+  }
+  scalar_or_into( destination + w, source + w, words - w );
+}
+
+__attribute__((target("sse2")))
+bool sse2_any(const uint64_t *words, size_t count) {
+  size_t w = 0;
+  for ( ; w + 2 <= count; w += 2 ) {
+    const __m128i block = _mm_loadu_si128( reinterpret_cast<const __m128i *>(words + w) );
+    if ( _mm_movemask_epi8( _mm_cmpeq_epi8( block, _mm_setzero_si128() ) ) != 0xFFFF ) return true;
+  }
+  return scalar_any( words + w, count - w );
+}
+
+__attribute__((target("sse2")))
+bool sse2_intersects(const uint64_t *lhs, const uint64_t *rhs, size_t words) {
+  size_t w = 0;
+  for ( ; w + 2 <= words; w += 2 ) {
+    const __m128i common = _mm_and_si128( _mm_loadu_si128( reinterpret_cast<const __m128i *>(lhs + w) ),
+                                          _mm_loadu_si128( reinterpret_cast<const __m128i *>(rhs + w) ) );
+    if ( _mm_movemask_epi8( _mm_cmpeq_epi8( common, _mm_setzero_si128() ) ) != 0xFFFF ) return true;
+  }
+  return scalar_intersects( lhs + w, rhs + w, words - w );
+}
+
+__attribute__((target("avx2")))
+void avx2_or_into(uint64_t *destination, const uint64_t *source, size_t words) {
+  size_t w = 0;
+  for ( ; w + 4 <= words; w += 4 ) {
+    const __m256i merged = _mm256_or_si256( _mm256_loadu_si256( reinterpret_cast<const __m256i *>(destination + w) ),
+                                            _mm256_loadu_si256( reinterpret_cast<const __m256i *>(source + w) ) );
+    _mm256_storeu_si256( reinterpret_cast<__m256i *>(destination + w), merged );
+  }
+  scalar_or_into( destination + w, source + w, words - w );
+}
+
+__attribute__((target("avx2")))
+bool avx2_any(const uint64_t *words, size_t count) {
+  size_t w = 0;
+  for ( ; w + 4 <= count; w += 4 ) {
+    const __m256i block = _mm256_loadu_si256( reinterpret_cast<const __m256i *>(words + w) );
+    if ( !_mm256_testz_si256( block, block ) ) return true;
+  }
+  return scalar_any( words + w, count - w );
+}
+
+__attribute__((target("avx2")))
+bool avx2_intersects(const uint64_t *lhs, const uint64_t *rhs, size_t words) {
+  size_t w = 0;
+  for ( ; w + 4 <= words; w += 4 ) {
+    if ( !_mm256_testz_si256( _mm256_loadu_si256( reinterpret_cast<const __m256i *>(lhs + w) ),
+                              _mm256_loadu_si256( reinterpret_cast<const __m256i *>(rhs + w) ) ) ) return true;
+  }
+  return scalar_intersects( lhs + w, rhs + w, words - w );
+}
+
+__attribute__((target("avx512f")))
+void avx512_or_into(uint64_t *destination, const uint64_t *source, size_t words) {
+  size_t w = 0;
+  for ( ; w + 8 <= words; w += 8 )
+    _mm512_storeu_si512( destination + w, _mm512_or_si512( _mm512_loadu_si512( destination + w ),
+                                                           _mm512_loadu_si512( source + w ) ) );
+  scalar_or_into( destination + w, source + w, words - w );
+}
+
+__attribute__((target("avx512f")))
+bool avx512_any(const uint64_t *words, size_t count) {
+  size_t w = 0;
+  for ( ; w + 8 <= count; w += 8 ) {
+    const __m512i block = _mm512_loadu_si512( words + w );
+    if ( _mm512_test_epi64_mask( block, block ) ) return true;
+  }
+  return scalar_any( words + w, count - w );
+}
+
+__attribute__((target("avx512f")))
+bool avx512_intersects(const uint64_t *lhs, const uint64_t *rhs, size_t words) {
+  size_t w = 0;
+  for ( ; w + 8 <= words; w += 8 )
+    if ( _mm512_test_epi64_mask( _mm512_loadu_si512( lhs + w ), _mm512_loadu_si512( rhs + w ) ) ) return true;
+  return scalar_intersects( lhs + w, rhs + w, words - w );
+}
+#endif
+
+SimdKernels simd_kernels = { "scalar", scalar_or_into, scalar_any, scalar_intersects };
+
+/*
+ * Description: Installs the bitset kernels named by @requested ("auto", "scalar", "sse2", "avx2" or "avx512") in
+ *              simd_kernels. "auto" picks the widest variant cpuid reports as usable. Returns false if the
+ *              requested variant is unknown or not supported by this CPU.
+ */
+bool select_simd_kernels(const std::string &requested) {
+  const SimdKernels scalar = { "scalar", scalar_or_into, scalar_any, scalar_intersects };
+  std::vector<SimdKernels> supported{ scalar };
+
+#if defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) )
+  __builtin_cpu_init();
+  if ( __builtin_cpu_supports( "sse2" ) )
+    supported.push_back( { "sse2", sse2_or_into, sse2_any, sse2_intersects } );
+  if ( __builtin_cpu_supports( "avx2" ) )
+    supported.push_back( { "avx2", avx2_or_into, avx2_any, avx2_intersects } );
+  if ( __builtin_cpu_supports( "avx512f" ) )
+    supported.push_back( { "avx512", avx512_or_into, avx512_any, avx512_intersects } );
+#endif
+
+  if ( requested == "auto" ) {
+    simd_kernels = supported.back();
+    return true;
+  }
+  for ( const auto &kernels : supported ) {
+    if ( requested == kernels.name ) {
+      simd_kernels = kernels;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+/*
+ * Description: Precomputes the epsilon-closure of every state, so that simulation never has to walk epsilon-edges.
+ *              The epsilon-edges are first condensed into strongly connected components (all states of a component
+ *              share one closure, so cycles cost nothing), and the components' closures are then built as bitsets
+ *              in reverse topological order. States without epsilon-edges keep a trivial closure.
+ */
+void compute_epsilon_closures(Automaton &automaton) {
+  const int state_count = static_cast<int>(automaton.state_ids.size());
+  std::vector<std::vector<int> > epsilon_edges( state_count );
+  bool has_epsilon = false;
+
+  const auto epsilon = std::find( automaton.symbols.begin(), automaton.symbols.end(), epsilon_symbol );
+  const uint32_t epsilon_code = 256 + static_cast<uint32_t>(epsilon - automaton.symbols.begin());
+
+  for ( const auto &transition : automaton.transitions ) {
+    if ( transition.symbol != epsilon_code ) continue;
+    epsilon_edges[ transition.source ].push_back( transition.target );
+    has_epsilon = true;
+  }
+
+  automaton.epsilon_closure_of.assign( state_count, -1 );
+  automaton.epsilon_closures.clear();
+  if ( !has_epsilon ) return;
+
+  //Tarjan's algorithm, iteratively, so that long epsilon-chains cannot overflow the stack. Components are completed
+  //successors-first, so every component a component reaches already has its closure when it is completed.
+  std::vector<int> order( state_count, -1 ), low( state_count, 0 ), component_of( state_count, -1 );
+  std::vector<int> stack, call_stack, next_edge( state_count, 0 );
+  std::vector<StateSet> component_closures;
+  int counter = 0;
+
+  for ( int root = 0; root < state_count; root++ ) {
+    if ( order[ root ] >= 0 ) continue;
+    call_stack.push_back( root );
+
+    while ( !call_stack.empty() ) {
+      const int state = call_stack.back();
+      if ( order[ state ] < 0 ) {
+        order[ state ] = low[ state ] = counter++;
+        stack.push_back( state );
+      }
+
+      if ( next_edge[ state ] < static_cast<int>(epsilon_edges[ state ].size()) ) {
+        const int target = epsilon_edges[ state ][ next_edge[ state ]++ ];
+        if ( order[ target ] < 0 ) call_stack.push_back( target );
+        else if ( component_of[ target ] < 0 ) low[ state ] = std::min( low[ state ], order[ target ] );
+        continue;
+      }
+
+      call_stack.pop_back();
+      if ( !call_stack.empty() ) low[ call_stack.back() ] = std::min( low[ call_stack.back() ], low[ state ] );
+      if ( low[ state ] != order[ state ] ) continue;
+
+      //state is the root of a component: pop its members and build the component's closure.
+      const int component = static_cast<int>(component_closures.size());
+      StateSet closure = make_state_set( state_count );
+      std::vector<int> members;
+      int member;
+      do {
+        member = stack.back();
+        stack.pop_back();
+        component_of[ member ] = component;
+        members.push_back( member );
+        state_set_insert( closure, member );
+      } while ( member != state );
+
+      for ( const int source : members ) {
+        for ( const int target : epsilon_edges[ source ] ) {
+          if ( component_of[ target ] == component ) continue;
+          const StateSet &reached = component_closures[ component_of[ target ] ];
+          for ( size_t w = 0; w < closure.words.size(); w++ ) closure.words[ w ] |= reached.words[ w ];
+        }
+      }
+      component_closures.push_back( closure );
+    }
+  }
+
+  //Only keep the closures which reach beyond the state itself.
+  std::vector<int> stored( component_closures.size(), -1 );
+  for ( int index = 0; index < state_count; index++ ) {
+    const int component = component_of[ index ];
+    const StateSet &closure = component_closures[ component ];
+    bool trivial = true;
+    for ( size_t w = 0; w < closure.words.size() && trivial; w++ )
+      trivial = closure.words[ w ] == ( w == static_cast<size_t>(index >> 6) ? uint64_t( 1 ) << ( index & 63 ) : 0 );
+    if ( trivial ) continue;
+
+    if ( stored[ component ] < 0 ) {
+      stored[ component ] = static_cast<int>(automaton.epsilon_closures.size());
+      automaton.epsilon_closures.push_back( closure );
+    }
+    automaton.epsilon_closure_of[ index ] = stored[ component ];
+  }
+}
+
+
+/*
+ * Description: Adds the state at dense index @index, together with its epsilon-closure, to @set.
+ */
+void insert_with_closure(
+        const Automaton &automaton,
+        StateSet &set,
+        int index
+) {
+  const int closure = automaton.epsilon_closure_of[ index ];
+  if ( closure < 0 ) {
+    state_set_insert( set, index );
+    return;
+  }
+  const auto &words = automaton.epsilon_closures[ closure ].words;
+  for ( size_t w = 0; w < words.size(); w++ ) set.words[ w ] |= words[ w ];
+}
+
+
+/*
+ * Description: Returns the set of states active before any input is read: the start state and its epsilon-closure.
+ */
+StateSet start_state_set(const Automaton &automaton) {
+  StateSet set = make_state_set( automaton.state_ids.size() );
+  if ( automaton.start_index >= 0 ) insert_with_closure( automaton, set, automaton.start_index );
+  return set;
+}
+
+
+/*
+ * Author: Jacob Berg
+ * Date: February 13, 2020 @ 3:40PM
+ * Description: After having processed data from input file (i.e. determining all states, whether they are start or
+ *              accept, and the outward transitions each possesses, we update the automatons start_index, the first
+ *              start state, for easier access.
+ */
+void config_start_and_accept_states(Automaton &automaton) {
+  for ( size_t w = 0; w < automaton.start_states.words.size() && automaton.start_index < 0; w++ )
+    if ( automaton.start_states.words[ w ] )
+      automaton.start_index = static_cast<int>(w * 64 + __builtin_ctzll( automaton.start_states.words[ w ] ));
+
+  compute_epsilon_closures( automaton );
+}
+
+
+/*
+ * The header of a .fsab file, the packed image of a CompiledAutomaton: this header, then each table in the order of
+ * FsabSection at a 64-byte aligned offset. A loader maps the file and uses the tables where they lie, so the file
+ * is only usable on a machine of the byte order it was written with.
+ */
+enum FsabSection {
+    fsab_offsets, fsab_targets, fsab_state_ids, fsab_accept_ids, fsab_start, fsab_accepting, fsab_successor_sets,
+    fsab_section_count
+};
+
+struct FsabHeader {
+    char magic[ 4 ];                      // "FSAB"
+    uint32_t version;
+    uint32_t byte_order;                  // fsab_byte_order, as stored by the machine that wrote the file
+    int32_t state_count;
+    int32_t class_count;
+    uint32_t reserved;
+    uint64_t set_words;
+    uint64_t file_bytes;
+    uint64_t section_offsets[ fsab_section_count ];
+    uint64_t section_counts[ fsab_section_count ];
+    uint8_t byte_class[ 256 ];
+};
+
+const uint32_t fsab_version = 1;
+const uint32_t fsab_byte_order = 0x01020304;
+
+//Largest table of per-(state, class) successor bitsets compile_automaton() will build.
+const size_t successor_sets_budget = size_t( 64 ) << 20;
+
+
+/*
+ * Description: Compresses the input alphabet into symbol classes: two bytes share a class when every state has
+ *              exactly the same transitions on both. Class 0 is reserved for the bytes no transition reads, so a
+ *              run can reject as soon as it meets one. Fewer classes make every engine's tables narrower.
+ * Parameters:
+ *    @const Automaton &automaton             : The automaton, after config_start_and_accept_states().
+ *    @CompiledAutomaton &compiled            : Receives byte_class and class_count.
+ */
+void compile_alphabet(
+        const Automaton &automaton,
+        CompiledAutomaton &compiled
+) {
+  //The signature of a byte lists, for every state with transitions on it, the state and its sorted targets.
+  std::array<std::vector<int>, 256> signatures;
+  std::vector<int> targets;
+
+  //Transitions are sorted by (source, symbol), so each run of equal ones lists the targets of one state on one symbol.
+  const auto &transitions = automaton.transitions;
+  for ( size_t first = 0, last; first < transitions.size(); first = last ) {
+    targets.clear();
+    for ( last = first; last < transitions.size() && transitions[ last ].source == transitions[ first ].source &&
+                        transitions[ last ].symbol == transitions[ first ].symbol; last++ )
+      targets.push_back( transitions[ last ].target );
+    if ( transitions[ first ].symbol >= 256 ) continue;
+
+    std::sort( targets.begin(), targets.end() );
+    targets.erase( std::unique( targets.begin(), targets.end() ), targets.end() );
+
+    auto &signature = signatures[ transitions[ first ].symbol ];
+    signature.push_back( transitions[ first ].source );
+    signature.push_back( static_cast<int>(targets.size()) );
+    signature.insert( signature.end(), targets.begin(), targets.end() );
+  }
+
+  std::map<std::vector<int>, int> classes{ { std::vector<int>(), 0 } };
+  for ( int byte = 0; byte < 256; byte++ ) {
+    const int symbol_class = classes.emplace( signatures[ byte ], static_cast<int>(classes.size()) ).first->second;
+    compiled.byte_class[ byte ] = static_cast<uint8_t>(symbol_class);
+  }
+  compiled.class_count = static_cast<int>(classes.size());
+}
+
+
+CompiledAutomaton::CompiledAutomaton(CompiledAutomaton &&other) noexcept {
+  *this = std::move( other );
+}
+
+CompiledAutomaton &CompiledAutomaton::operator=(CompiledAutomaton &&other) noexcept {
+  if ( this == &other ) return *this;
+  unmap_file( mapping );
+  state_count = other.state_count;
+  class_count = other.class_count;
+  byte_class = other.byte_class;
+  offsets = other.offsets;
+  targets = other.targets;
+  start = std::move( other.start );
+  accepting = std::move( other.accepting );
+  state_ids = other.state_ids;
+  accept_ids = other.accept_ids;
+  set_words = other.set_words;
+  successor_sets = other.successor_sets;
+  storage = std::move( other.storage );
+  mapping = other.mapping;
+  other.mapping = MappedFile();
+  return *this;
+}
+
+CompiledAutomaton::~CompiledAutomaton() {
+  unmap_file( mapping );
+}
+
+
+template<typename T>
+void bind_section(const char *image, const FsabHeader &header, FsabSection section, ArrayView<T> &view) {
+  view.items = reinterpret_cast<const T *>(image + header.section_offsets[ section ]);
+  view.count = header.section_counts[ section ];
+}
+
+/*
+ * Description: Points the tables of @compiled at the packed .fsab image @image, which must stay in place for as long
+ *              as @compiled is used; only the small start and accepting sets are copied out of it.
+ */
+void bind_compiled_image(
+        const char *image,
+        CompiledAutomaton &compiled
+) {
+  const FsabHeader &header = *reinterpret_cast<const FsabHeader *>(image);
+  compiled.state_count = header.state_count;
+  compiled.class_count = header.class_count;
+  std::copy( header.byte_class, header.byte_class + 256, compiled.byte_class.begin() );
+  compiled.set_words = header.set_words;
+
+  bind_section( image, header, fsab_offsets, compiled.offsets );
+  bind_section( image, header, fsab_targets, compiled.targets );
+  bind_section( image, header, fsab_state_ids, compiled.state_ids );
+  bind_section( image, header, fsab_accept_ids, compiled.accept_ids );
+  bind_section( image, header, fsab_successor_sets, compiled.successor_sets );
+
+  ArrayView<uint64_t> words;
+  bind_section( image, header, fsab_start, words );
+  compiled.start.words.assign( words.begin(), words.end() );
+  bind_section( image, header, fsab_accepting, words );
+  compiled.accepting.words.assign( words.begin(), words.end() );
+}
+
+
+/*
+ * Description: Builds the execution form of @automaton. Bytes are grouped into symbol classes by
+ *              compile_alphabet(), and the targets of each (state, class) pair are sorted, deduplicated and expanded
+ *              by their epsilon-closures. The tables are packed into one image in the .fsab layout.
+ * Parameters:
+ *    @const Automaton &automaton             : The automaton, after config_start_and_accept_states().
+ *    @CompiledAutomaton &compiled            : Receives the execution form.
+ *    @std::string &error                     : Receives the reason on failure.
+ * Returns: false if the expanded targets are too many for the 32-bit row offsets of the table and the .fsab format.
+ */
+bool compile_automaton(
+        const Automaton &automaton,
+        CompiledAutomaton &compiled,
+        std::string &error
+) {
+  compiled = CompiledAutomaton();
+  const int state_count = static_cast<int>(automaton.state_ids.size());
+  compiled.state_count = state_count;
+
+  compile_alphabet( automaton, compiled );
+
+  const int class_count = compiled.class_count;
+  std::vector<std::vector<int32_t> > row_targets( class_count );
+  std::vector<uint32_t> offsets( static_cast<size_t>(state_count) * class_count + 1, 0 );
+  std::vector<int32_t> all_targets, accept_ids;
+  const std::vector<int32_t> &state_ids = automaton.state_ids;
+  std::vector<uint64_t> successor_sets;
+
+  for ( int index = 0; index < state_count; index++ ) {
+    for ( size_t i = automaton.transition_offsets[ index ]; i < automaton.transition_offsets[ index + 1 ]; i++ ) {
+      const Transition &transition = automaton.transitions[ i ];
+      if ( transition.symbol >= 256 ) continue;
+      auto &targets = row_targets[ compiled.byte_class[ transition.symbol ] ];
+
+      const int closure = automaton.epsilon_closure_of[ transition.target ];
+      if ( closure < 0 ) {
+        targets.push_back( transition.target );
+        continue;
+      }
+      for_each_state( automaton.epsilon_closures[ closure ], [&](int reached) { targets.push_back( reached ); } );
+    }
+
+    for ( int symbol_class = 0; symbol_class < class_count; symbol_class++ ) {
+      auto &targets = row_targets[ symbol_class ];
+      std::sort( targets.begin(), targets.end() );
+      targets.erase( std::unique( targets.begin(), targets.end() ), targets.end() );
+      offsets[ static_cast<size_t>(index) * class_count + symbol_class ] = static_cast<uint32_t>(all_targets.size());
+      all_targets.insert( all_targets.end(), targets.begin(), targets.end() );
+      targets.clear();
+    }
+    if ( all_targets.size() > UINT32_MAX ) {
+      error = "The automaton has more than " + std::to_string( UINT32_MAX ) + " transition targets once its"
+              " epsilon-transitions are expanded, too many for a compiled automaton.";
+      return false;
+    }
+  }
+  offsets.back() = static_cast<uint32_t>(all_targets.size());
+
+  const StateSet start = start_state_set( automaton );
+  const StateSet &accepting = automaton.accept_states;
+  for_each_state( accepting, [&](int index) { accept_ids.push_back( automaton.state_ids[ index ] ); } );
+  std::sort( accept_ids.begin(), accept_ids.end() );
+
+  //When they fit the budget, also store every row's targets as a bitset, so that a step is a run of wide ORs.
+  const size_t set_words = start.words.size();
+  const size_t rows = static_cast<size_t>(state_count) * compiled.class_count;
+  if ( rows * set_words * sizeof( uint64_t ) <= successor_sets_budget ) {
+    successor_sets.assign( rows * set_words, 0 );
+    for ( size_t row = 0; row < rows; row++ ) {
+      uint64_t *set = &successor_sets[ row * set_words ];
+      for ( uint32_t i = offsets[ row ]; i < offsets[ row + 1 ]; i++ )
+        set[ all_targets[ i ] >> 6 ] |= uint64_t( 1 ) << ( all_targets[ i ] & 63 );
+    }
+  }
+
+  //Lay every table out in the .fsab layout, so that the image can be written to a file as it is.
+  FsabHeader header;
+  std::memset( &header, 0, sizeof( header ) );
+  std::memcpy( header.magic, "FSAB", 4 );
+  header.version = fsab_version;
+  header.byte_order = fsab_byte_order;
+  header.state_count = state_count;
+  header.class_count = class_count;
+  header.set_words = set_words;
+  std::copy( compiled.byte_class.begin(), compiled.byte_class.end(), header.byte_class );
+
+  const std::pair<const void *, size_t> sections[ fsab_section_count ] = {
+          { offsets.data(), offsets.size() * sizeof( uint32_t ) },
+          { all_targets.data(), all_targets.size() * sizeof( int32_t ) },
+          { state_ids.data(), state_ids.size() * sizeof( int32_t ) },
+          { accept_ids.data(), accept_ids.size() * sizeof( int32_t ) },
+          { start.words.data(), set_words * sizeof( uint64_t ) },
+          { accepting.words.data(), set_words * sizeof( uint64_t ) },
+          { successor_sets.data(), successor_sets.size() * sizeof( uint64_t ) }
+  };
+  const size_t element_bytes[ fsab_section_count ] = { 4, 4, 4, 4, 8, 8, 8 };
+  size_t bytes = sizeof( FsabHeader );
+  for ( int section = 0; section < fsab_section_count; section++ ) {
+    bytes = ( bytes + 63 ) & ~size_t( 63 );
+    header.section_offsets[ section ] = bytes;
+    header.section_counts[ section ] = sections[ section ].second / element_bytes[ section ];
+    bytes += sections[ section ].second;
+  }
+  header.file_bytes = bytes;
+
+  compiled.storage.assign( ( bytes + 7 ) / 8, 0 );
+  char *image = reinterpret_cast<char *>(compiled.storage.data());
+  std::memcpy( image, &header, sizeof( header ) );
+  for ( int section = 0; section < fsab_section_count; section++ )
+    if ( sections[ section ].second )
+      std::memcpy( image + header.section_offsets[ section ], sections[ section ].first, sections[ section ].second );
+
+  bind_compiled_image( image, compiled );
+  return true;
+}
+
+
+/*
+ * Description: Writes the packed image of @compiled to @file_name as a .fsab file. Returns false on failure.
+ */
+bool write_compiled(
+        const CompiledAutomaton &compiled,
+        const std::string &file_name
+) {
+  const FsabHeader &header = *reinterpret_cast<const FsabHeader *>(compiled.storage.data());
+  FILE *file = fopen( file_name.c_str(), "wb" );
+  if ( !file ) return false;
+
+  const bool written = fwrite( compiled.storage.data(), 1, header.file_bytes, file ) == header.file_bytes;
+  return fclose( file ) == 0 && written;
+}
+
+/*
+ * Description: Checks that the .fsab image [@image, @image + @size) was written by this version on a machine of
+ *              this byte order, and that every table its header describes lies inside it, is aligned, has the size
+ *              the header implies and only names states that exist, so that no engine can read outside the image
+ *              however the file was damaged. Takes time linear in the number of rows and targets.
+ */
+bool validate_compiled_image(
+        const char *image,
+        size_t size
+) {
+  if ( size < sizeof( FsabHeader ) ) return false;
+  const FsabHeader &header = *reinterpret_cast<const FsabHeader *>(image);
+  if ( header.version != fsab_version || header.byte_order != fsab_byte_order || header.file_bytes > size ||
+       header.state_count < 0 || header.class_count < 1 || header.class_count > 256 )
+    return false;
+  for ( int byte = 0; byte < 256; byte++ ) if ( header.byte_class[ byte ] >= header.class_count ) return false;
+
+  const uint64_t state_count = static_cast<uint64_t>(header.state_count);
+  const uint64_t rows = state_count * static_cast<uint64_t>(header.class_count);
+  const uint64_t set_words = header.set_words;
+  if ( set_words != ( state_count + 63 ) / 64 ) return false;
+
+  const uint64_t element_bytes[ fsab_section_count ] = { 4, 4, 4, 4, 8, 8, 8 };
+  for ( int section = 0; section < fsab_section_count; section++ ) {
+    const uint64_t offset = header.section_offsets[ section ];
+    if ( offset % 64 != 0 || offset < sizeof( FsabHeader ) || offset > header.file_bytes ||
+         header.section_counts[ section ] > ( header.file_bytes - offset ) / element_bytes[ section ] )
+      return false;
+  }
+
+  const uint64_t *counts = header.section_counts;
+  if ( counts[ fsab_offsets ] != rows + 1 || counts[ fsab_state_ids ] != state_count ||
+       counts[ fsab_accept_ids ] > state_count || counts[ fsab_start ] != set_words ||
+       counts[ fsab_accepting ] != set_words ||
+       ( counts[ fsab_successor_sets ] != 0 && counts[ fsab_successor_sets ] != rows * set_words ) )
+    return false;
+
+  const uint32_t *offsets = reinterpret_cast<const uint32_t *>(image + header.section_offsets[ fsab_offsets ]);
+  const int32_t *targets = reinterpret_cast<const int32_t *>(image + header.section_offsets[ fsab_targets ]);
+  if ( offsets[ 0 ] != 0 || offsets[ rows ] != counts[ fsab_targets ] ) return false;
+  for ( uint64_t row = 0; row < rows; row++ ) if ( offsets[ row ] > offsets[ row + 1 ] ) return false;
+  for ( uint64_t i = 0; i < counts[ fsab_targets ]; i++ )
+    if ( targets[ i ] < 0 || targets[ i ] >= header.state_count ) return false;
+
+  //A bit past the last state in any bitset would name a state that does not exist.
+  if ( set_words == 0 ) return true;
+  const uint64_t padding = state_count % 64 ? ~uint64_t( 0 ) << ( state_count % 64 ) : 0;
+  const auto last_word = [&](FsabSection section, uint64_t set) {
+    return reinterpret_cast<const uint64_t *>(image + header.section_offsets[ section ])[ set * set_words +
+                                                                                          set_words - 1 ];
+  };
+  if ( ( last_word( fsab_start, 0 ) | last_word( fsab_accepting, 0 ) ) & padding ) return false;
+  for ( uint64_t row = 0; row < counts[ fsab_successor_sets ] / set_words; row++ )
+    if ( last_word( fsab_successor_sets, row ) & padding ) return false;
+  return true;
+}
+
+/*
+ * Description: Loads @file_name into @compiled if it is a .fsab file, mapping it and using its tables in place with
+ *              no parsing; @compiled owns the mapping from then on. Returns false if the file is not a .fsab file,
+ *              so that it can be read as a specification instead, or with the reason in @error if it is one but was
+ *              written by another version or on a machine of another byte order, or is truncated or damaged; see
+ *              validate_compiled_image().
+ */
+bool load_compiled(
+        const std::string &file_name,
+        CompiledAutomaton &compiled,
+        std::string &error
+) {
+  const int fd = open( file_name.c_str(), O_RDONLY );
+  MappedFile mapped;
+  if ( fd < 0 ) return false;
+  const bool is_mapped = map_file( fd, mapped );
+  close( fd );
+  if ( !is_mapped ) return false;
+
+  if ( mapped.size < 4 || std::memcmp( mapped.data, "FSAB", 4 ) != 0 ) {
+    unmap_file( mapped );
+    return false;
+  }
+  if ( !validate_compiled_image( mapped.data, mapped.size ) ) {
+    error = file_name + " is a compiled automaton from another version or machine, or is truncated or damaged."
+            " Compile it again from its specification.";
+    unmap_file( mapped );
+    return false;
+  }
+
+  compiled = CompiledAutomaton();
+  compiled.mapping = mapped;
+  bind_compiled_image( mapped.data, compiled );
+  return true;
+}
+
+
+/*
+ * Description: Computes the set of states reachable from any state of @current on a symbol of class @symbol_class,
+ *              followed by any number of epsilon-transitions, storing it in @next. Both are bitsets of
+ *              compiled.set_words words, and must not overlap.
+ * Parameters:
+ *    @const CompiledAutomaton &compiled      : The compiled automaton.
+ *    @const uint64_t *current                : The states active before the symbol is read.
+ *    @int symbol_class                       : The class of the symbol being read.
+ *    @uint64_t *next                         : Receives the states active after the symbol is read.
+ */
+void step_state_words(
+        const CompiledAutomaton &compiled,
+        const uint64_t *current,
+        int symbol_class,
+        uint64_t *next
+) {
+  const size_t words = compiled.set_words;
+  std::fill( next, next + words, 0 );
+
+  if ( !compiled.successor_sets.empty() ) {
+    for_each_state( current, words, [&](int index) {
+      const size_t row = static_cast<size_t>(index) * compiled.class_count + symbol_class;
+      simd_kernels.or_into( next, &compiled.successor_sets[ row * words ], words );
+    } );
+    return;
+  }
+
+  for_each_state( current, words, [&](int index) {
+    const size_t row = static_cast<size_t>(index) * compiled.class_count + symbol_class;
+    for ( uint32_t i = compiled.offsets[ row ]; i < compiled.offsets[ row + 1 ]; i++ )
+      next[ compiled.targets[ i ] >> 6 ] |= uint64_t( 1 ) << ( compiled.targets[ i ] & 63 );
+  } );
+}
+
+void step_state_set(
+        const CompiledAutomaton &compiled,
+        const StateSet &current,
+        int symbol_class,
+        StateSet &next
+) {
+  step_state_words( compiled, current.words.data(), symbol_class, next.words.data() );
+}
+
+
+/*
+ * Description: Fills @output with the ids of the states in @final_set, accepting if any of them is an accept state.
+ */
+void output_state_set(
+        const CompiledAutomaton &compiled,
+        const StateSet &final_set,
+        Output &output
+) {
+  for_each_state( final_set, [&](int index) { output.final_states.push_back( compiled.state_ids[ index ] ); } );
+  if ( simd_kernels.intersects( final_set.words.data(), compiled.accepting.words.data(), compiled.set_words ) )
+    output.is_accept = true;
+}
+
+
+/*
+ * Description: Advances the frontier @current over the symbols [@begin, @end), using @next as scratch space. Rather
+ *              than following each nondeterministic path on its own, every position keeps one deduplicated frontier
+ *              of the states active there, so a run costs O(n * |transitions|) and no recursion is needed. Paths
+ *              with no transition on the current symbol die, and a symbol outside the alphabet empties the frontier
+ *              at once. Because only the frontier is kept, an input can be fed in any number of pieces.
+ * Parameters:
+ *    @const CompiledAutomaton &compiled      : The compiled automaton.
+ *    @StateSet &current                      : The states active before the first symbol; left holding those after.
+ *    @StateSet &next                         : Scratch set of the same size as @current.
+ *    @const char *begin, *end                : The symbols to consume.
+ */
+void frontier_feed(
+        const CompiledAutomaton &compiled,
+        StateSet &current,
+        StateSet &next,
+        const char *begin,
+        const char *end
+) {
+  if ( !simd_kernels.any( current.words.data(), compiled.set_words ) ) return;
+
+  for ( const char *c = begin; c != end; c++ ) {
+    const int symbol_class = compiled.byte_class[ static_cast<unsigned char>(*c) ];
+    if ( symbol_class == 0 ) {
+      state_set_clear( current );
+      return;
+    }
+    step_state_set( compiled, current, symbol_class, next );
+    std::swap( current, next );
+    if ( !simd_kernels.any( current.words.data(), compiled.set_words ) ) return;
+  }
+}
+
+
+template<typename Word>
+Word word_from_state_set(const StateSet &set) {
+  Word word = 0;
+  for_each_state( set, [&](int index) { word |= Word( 1 ) << index; } );
+  return word;
+}
+
+/*
+ * Description: Builds the bit-parallel form of @compiled, which must have at most as many states as Word has bits.
+ */
+template<typename Word>
+BitParallelNfa<Word> make_bit_parallel_nfa(const CompiledAutomaton &compiled) {
+  BitParallelNfa<Word> nfa;
+  const int class_count = compiled.class_count;
+  nfa.class_count = class_count;
+  nfa.chunk_count = std::max( 1, ( compiled.state_count + 7 ) / 8 );
+  nfa.start = word_from_state_set<Word>( compiled.start );
+  nfa.accepting = word_from_state_set<Word>( compiled.accepting );
+  nfa.successors.assign( static_cast<size_t>(nfa.chunk_count) * class_count * 256, 0 );
+
+  for ( int chunk = 0; chunk < nfa.chunk_count; chunk++ ) {
+    for ( int symbol_class = 0; symbol_class < class_count; symbol_class++ ) {
+      Word *table = &nfa.successors[ ( static_cast<size_t>(chunk) * class_count + symbol_class ) * 256 ];
+
+      //Each value's successors are those of the value without its lowest state, plus that state's own.
+      for ( int value = 1; value < 256; value++ ) {
+        const int index = chunk * 8 + __builtin_ctz( value );
+        Word own = 0;
+        if ( index < compiled.state_count ) {
+          const size_t row = static_cast<size_t>(index) * class_count + symbol_class;
+          for ( uint32_t i = compiled.offsets[ row ]; i < compiled.offsets[ row + 1 ]; i++ )
+            own |= Word( 1 ) << compiled.targets[ i ];
+        }
+        table[ value ] = table[ value & ( value - 1 ) ] | own;
+      }
+    }
+  }
+
+  return nfa;
+}
+
+/*
+ * Description: Advances the bit-parallel frontier @current over the symbols [@begin, @end).
+ */
+template<typename Word>
+void bit_parallel_feed(
+        const CompiledAutomaton &compiled,
+        const BitParallelNfa<Word> &nfa,
+        Word &current,
+        const char *begin,
+        const char *end
+) {
+  const size_t chunk_stride = static_cast<size_t>(nfa.class_count) * 256;
+
+  for ( const char *c = begin; c != end && current; c++ ) {
+    const int symbol_class = compiled.byte_class[ static_cast<unsigned char>(*c) ];
+    const Word *table = &nfa.successors[ static_cast<size_t>(symbol_class) * 256 ];
+    Word next = 0;
+    for ( int chunk = 0; chunk < nfa.chunk_count; chunk++ )
+      next |= table[ chunk * chunk_stride + static_cast<uint8_t>(current >> ( chunk * 8 )) ];
+    current = next;
+  }
+}
+
+/*
+ * Description: Fills @output with the states of the bit-parallel frontier @current, and whether any accepts.
+ */
+template<typename Word>
+void bit_parallel_output(
+        const CompiledAutomaton &compiled,
+        const BitParallelNfa<Word> &nfa,
+        Word current,
+        Output &output
+) {
+  for ( int index = 0; index < compiled.state_count; index++ )
+    if ( ( current >> index ) & 1 ) output.final_states.push_back( compiled.state_ids[ index ] );
+  if ( current & nfa.accepting ) output.is_accept = true;
+}
+
+
+/*
+ * A square boolean matrix over the automaton's states, bit-packed by rows: bit t of row s is set when state t is
+ * reachable from state s. Reading a string multiplies the relations of its symbols together.
+ */
+struct BitMatrix {
+    size_t size = 0;
+    size_t words = 0;                     // Words per row.
+    std::vector<uint64_t> bits;           // <row * words + word, uint64_t>
+};
+
+BitMatrix make_bit_matrix(size_t size) {
+  BitMatrix matrix;
+  matrix.size = size;
+  matrix.words = ( size + 63 ) / 64;
+  matrix.bits.assign( size * matrix.words, 0 );
+  return matrix;
+}
+
+/*
+ * Description: Computes @product = @lhs * @rhs over the boolean semiring with the method of Four Russians. The rows
+ *              of @rhs are taken 8 at a time; all 256 unions of those 8 rows are tabulated once, and each row of
+ *              @lhs then ORs in one table entry per block, picked by its 8 bits for that block. Rows are combined
+ *              with the SIMD kernels, and the table of a block (256 rows) stays in cache while every row of @lhs
+ *              passes over it.
+ */
+void bit_matrix_multiply(
+        const BitMatrix &lhs,
+        const BitMatrix &rhs,
+        BitMatrix &product
+) {
+  const size_t size = lhs.size, words = lhs.words;
+  product = make_bit_matrix( size );
+  std::vector<uint64_t> table( 256 * words );
+
+  for ( size_t block = 0; block * 8 < size; block++ ) {
+    const size_t rows = std::min( size_t( 8 ), size - block * 8 );
+    std::fill( table.begin(), table.begin() + words, 0 );
+    for ( size_t value = 1; value < ( size_t( 1 ) << rows ); value++ ) {
+      uint64_t *entry = &table[ value * words ];
+      const uint64_t *without_lowest = &table[ ( value & ( value - 1 ) ) * words ];
+      std::copy( without_lowest, without_lowest + words, entry );
+      simd_kernels.or_into( entry, &rhs.bits[ ( block * 8 + __builtin_ctzll( value ) ) * words ], words );
+    }
+
+    for ( size_t row = 0; row < size; row++ ) {
+      const size_t value = ( lhs.bits[ row * words + block / 8 ] >> ( ( block % 8 ) * 8 ) ) & 0xFF;
+      if ( value ) simd_kernels.or_into( &product.bits[ row * words ], &table[ value * words ], words );
+    }
+  }
+}
+
+/*
+ * Description: Computes the relation of the input [@begin, @end): the states reachable from each state by reading
+ *              it. Every state starts as a row of its own, rows are stepped like frontiers, and rows which become
+ *              equal are merged for good, so converging automata soon cost no more than a single scan. The rows
+ *              live in two preallocated buffers and are deduplicated through an open-addressed table of their
+ *              hashes, so a step allocates nothing; once a single row is left, frontier_feed() finishes the chunk.
+ */
+void nfa_map_chunk(
+        const CompiledAutomaton &compiled,
+        const char *begin,
+        const char *end,
+        BitMatrix &relation
+) {
+  const int state_count = compiled.state_count;
+  const size_t words = compiled.set_words;
+
+  //lane_of[ s ] is the lane the run started in state s follows; lanes holds each lane's frontier, words apiece.
+  std::vector<uint64_t> lanes( state_count * words, 0 ), stepped( state_count * words );
+  std::vector<uint64_t> hashes( state_count );
+  std::vector<size_t> slot_of( state_count );
+  std::vector<int> lane_of( state_count ), remap( state_count );
+  size_t lane_count = static_cast<size_t>(state_count);
+  for ( int s = 0; s < state_count; s++ ) {
+    lanes[ s * words + s / 64 ] |= uint64_t( 1 ) << ( s % 64 );
+    lane_of[ s ] = s;
+  }
+
+  //slots[ hash & mask ] is the stepped lane with that hash, or -1; probing is linear and at most half are full.
+  size_t slot_count = 2;
+  while ( slot_count < 2 * lane_count ) slot_count *= 2;
+  const size_t mask = slot_count - 1;
+  std::vector<int> slots( slot_count, -1 );
+
+  const char *position = begin;
+  while ( position != end && lane_count > 1 ) {
+    const int symbol_class = compiled.byte_class[ static_cast<unsigned char>(*position++) ];
+
+    //Step every lane into the next free row of stepped; a row equal to an earlier one is dropped again.
+    size_t kept = 0;
+    for ( size_t lane = 0; lane < lane_count; lane++ ) {
+      uint64_t *next = &stepped[ kept * words ];
+      step_state_words( compiled, &lanes[ lane * words ], symbol_class, next );
+      uint64_t hash = 14695981039346656037ULL;
+      for ( size_t w = 0; w < words; w++ ) hash = ( hash ^ next[ w ] ) * 1099511628211ULL;
+      hash ^= hash >> 29;
+
+      size_t slot = hash & mask;
+      while ( slots[ slot ] >= 0 && ( hashes[ slots[ slot ] ] != hash ||
+              !std::equal( next, next + words, &stepped[ slots[ slot ] * words ] ) ) )
+        slot = ( slot + 1 ) & mask;
+      if ( slots[ slot ] < 0 ) {
+        slots[ slot ] = static_cast<int>(kept);
+        slot_of[ kept ] = slot;
+        hashes[ kept++ ] = hash;
+      }
+      remap[ lane ] = slots[ slot ];
+    }
+
+    for ( size_t lane = 0; lane < kept; lane++ ) slots[ slot_of[ lane ] ] = -1;
+    if ( kept < lane_count )
+      for ( auto &lane : lane_of ) lane = remap[ lane ];
+    lane_count = kept;
+    std::swap( lanes, stepped );
+  }
+
+  //Once every run has converged, a single frontier scan finishes the chunk.
+  if ( lane_count == 1 && position != end ) {
+    StateSet current = make_state_set( state_count ), next = current;
+    std::copy( lanes.begin(), lanes.begin() + words, current.words.begin() );
+    frontier_feed( compiled, current, next, position, end );
+    std::copy( current.words.begin(), current.words.end(), lanes.begin() );
+  }
+
+  relation = make_bit_matrix( state_count );
+  for ( int s = 0; s < state_count; s++ )
+    std::copy( &lanes[ lane_of[ s ] * words ], &lanes[ lane_of[ s ] * words ] + words,
+               &relation.bits[ s * relation.words ] );
+}
+
+/*
+ * Description: Runs one large input [@begin, @end) through the NFA on @thread_count threads, filling @output exactly
+ *              as the stream engine does. The input is cut into one chunk per thread. The first chunk is simulated
+ *              from the start states with frontier_feed(), and every other one is turned into its boolean transition
+ *              matrix with nfa_map_chunk(). Those matrices are multiplied together as a tree, each level's products
+ *              running in parallel, and the frontier after the first chunk is finally applied to the product.
+ */
+void nfa_run_matrix(
+        const CompiledAutomaton &compiled,
+        const char *begin,
+        const char *end,
+        size_t thread_count,
+        Output &output
+) {
+  const size_t min_chunk = size_t( 1 ) << 16;
+  const size_t length = static_cast<size_t>(end - begin);
+  const size_t chunk_count = std::max( size_t( 1 ), std::min( thread_count, length / min_chunk ) );
+  const size_t chunk_length = length / chunk_count;
+
+  std::vector<BitMatrix> relations( chunk_count - 1 );
+  std::vector<std::thread> workers;
+  for ( size_t chunk = 1; chunk < chunk_count; chunk++ ) {
+    const char *chunk_begin = begin + chunk * chunk_length;
+    const char *chunk_end = chunk + 1 == chunk_count ? end : chunk_begin + chunk_length;
+    workers.emplace_back( nfa_map_chunk, std::cref( compiled ), chunk_begin, chunk_end,
+                          std::ref( relations[ chunk - 1 ] ) );
+  }
+
+  StateSet current = compiled.start, next = current;
+  frontier_feed( compiled, current, next, begin, chunk_count == 1 ? end : begin + chunk_length );
+
+  for ( auto &worker : workers ) worker.join();
+  workers.clear();
+
+  //Multiply neighbouring relations pairwise until one product of them all is left.
+  for ( size_t stride = 1; stride < relations.size(); stride *= 2 ) {
+    for ( size_t i = 0; i + stride < relations.size(); i += 2 * stride ) {
+      workers.emplace_back( [&relations, i, stride]() {
+        BitMatrix product;
+        bit_matrix_multiply( relations[ i ], relations[ i + stride ], product );
+        relations[ i ] = std::move( product );
+      } );
+    }
+    for ( auto &worker : workers ) worker.join();
+    workers.clear();
+  }
+
+  if ( !relations.empty() ) {
+    state_set_clear( next );
+    for_each_state( current, [&](int index) {
+      simd_kernels.or_into( next.words.data(), &relations[ 0 ].bits[ index * relations[ 0 ].words ],
+                            relations[ 0 ].words );
+    } );
+    std::swap( current, next );
+  }
+
+  output_state_set( compiled, current, output );
+}
+
+
+/*
+ * Description: Creates an empty lazy DFA over @automaton whose cache may use about @cache_limit bytes.
+ */
+LazyDfa make_lazy_dfa(const CompiledAutomaton &automaton, size_t cache_limit) {
+  LazyDfa dfa;
+  dfa.automaton = &automaton;
+  dfa.cache_limit = cache_limit;
+  return dfa;
+}
+
+/*
+ * Description: Drops every cached DFA state and transition.
+ */
+void lazy_dfa_flush(LazyDfa &dfa) {
+  dfa.sets.clear();
+  dfa.table.clear();
+  dfa.ids.clear();
+  dfa.cache_bytes = 0;
+  dfa.start = LazyDfa::unknown;
+}
+
+/*
+ * Description: Returns the DFA state standing for @set, creating it if it has not been seen since the last flush.
+ */
+int lazy_dfa_intern(LazyDfa &dfa, const StateSet &set) {
+  auto itr = dfa.ids.find( set );
+  if ( itr != dfa.ids.end() ) return itr->second;
+
+  const int class_count = dfa.automaton->class_count;
+  const int dfa_state = static_cast<int>(dfa.sets.size());
+  dfa.sets.push_back( set );
+  dfa.table.resize( dfa.table.size() + class_count, LazyDfa::unknown );
+  dfa.ids.emplace( set, dfa_state );
+  //Each state costs its row, its set (stored twice) and roughly a hash node.
+  dfa.cache_bytes += class_count * sizeof( int32_t ) + 2 * set.words.size() * sizeof( uint64_t ) + 64;
+  return dfa_state;
+}
+
+int lazy_dfa_start(LazyDfa &dfa) {
+  if ( dfa.start == LazyDfa::unknown ) dfa.start = lazy_dfa_intern( dfa, dfa.automaton->start );
+  return dfa.start;
+}
+
+/*
+ * Description: Slow path of a lazy DFA step, taken when the successor of @dfa_state on @symbol_class is not cached.
+ *              Determinizes that one transition, flushing the cache first if it has outgrown its limit. Since a
+ *              flush renumbers the DFA states, @dfa_state is updated to the current state's new number.
+ */
+int lazy_dfa_successor(LazyDfa &dfa, int &dfa_state, int symbol_class) {
+  StateSet next = make_state_set( dfa.automaton->state_count );
+  step_state_set( *dfa.automaton, dfa.sets[ dfa_state ], symbol_class, next );
+
+  if ( dfa.cache_bytes > dfa.cache_limit && dfa.ids.find( next ) == dfa.ids.end() ) {
+    StateSet current = dfa.sets[ dfa_state ];
+    lazy_dfa_flush( dfa );
+    dfa_state = lazy_dfa_intern( dfa, current );
+  }
+
+  const int successor = lazy_dfa_intern( dfa, next );
+  dfa.table[ static_cast<size_t>(dfa_state) * dfa.automaton->class_count + symbol_class ] = successor;
+  return successor;
+}
+
+/*
+ * Description: Advances @dfa_state over the symbols [@begin, @end), building states as they are first reached. A
+ *              cache flush renumbers the states, and @dfa_state is updated to match.
+ */
+void lazy_dfa_feed(
+        LazyDfa &dfa,
+        int &dfa_state,
+        const char *begin,
+        const char *end
+) {
+  const CompiledAutomaton &compiled = *dfa.automaton;
+
+  for ( const char *c = begin; c != end; c++ ) {
+    const int symbol_class = compiled.byte_class[ static_cast<unsigned char>(*c) ];
+    int next = dfa.table[ static_cast<size_t>(dfa_state) * compiled.class_count + symbol_class ];
+    if ( next == LazyDfa::unknown ) next = lazy_dfa_successor( dfa, dfa_state, symbol_class );
+    dfa_state = next;
+  }
+}
+
+
+/*
+ * Description: Compiles @automaton into @dfa by the powerset construction, exploring only the state sets reachable
+ *              from the start state.
+ * Parameters:
+ *    @const CompiledAutomaton &automaton     : The compiled automaton.
+ *    @size_t max_states                      : The most DFA states the construction may create.
+ *    @Dfa &dfa                               : Receives the DFA.
+ * Returns: false if the DFA would need more than @max_states states, in which case @dfa is incomplete.
+ */
+bool compile_dfa(
+        const CompiledAutomaton &automaton,
+        size_t max_states,
+        Dfa &dfa
+) {
+  const int class_count = automaton.class_count;
+  std::unordered_map<StateSet, int, StateSetHash, StateSetEqual> ids;
+
+  auto intern = [&](const StateSet &set) {
+    auto itr = ids.find( set );
+    if ( itr != ids.end() ) return itr->second;
+    if ( dfa.sets.size() >= max_states ) return -1;
+
+    const int dfa_state = static_cast<int>(dfa.sets.size());
+    dfa.sets.push_back( set );
+    dfa.accepting.push_back( state_set_intersects( set, automaton.accepting ) );
+    ids.emplace( set, dfa_state );
+    return dfa_state;
+  };
+
+  StateSet next = make_state_set( automaton.state_count );
+  dfa.class_count = class_count;
+  dfa.start = intern( automaton.start );
+  if ( dfa.start < 0 ) return false;
+
+  //dfa.sets grows as new state sets are discovered, so this visits each one exactly once.
+  for ( size_t dfa_state = 0; dfa_state < dfa.sets.size(); dfa_state++ ) {
+    dfa.table.resize( dfa.table.size() + class_count, -1 );
+
+    for ( int symbol_class = 0; symbol_class < class_count; symbol_class++ ) {
+      step_state_set( automaton, dfa.sets[ dfa_state ], symbol_class, next );
+      const int successor = intern( next );
+      if ( successor < 0 ) return false;
+      dfa.table[ dfa_state * class_count + symbol_class ] = successor;
+    }
+  }
+
+  return true;
+}
+
+/*
+ * Description: Advances @dfa_state over the symbols [@begin, @end) of @dfa.
+ */
+void dfa_feed(
+        const CompiledAutomaton &automaton,
+        const Dfa &dfa,
+        int &dfa_state,
+        const char *begin,
+        const char *end
+) {
+  for ( const char *c = begin; c != end; c++ ) {
+    const int symbol_class = automaton.byte_class[ static_cast<unsigned char>(*c) ];
+    dfa_state = dfa.table[ static_cast<size_t>(dfa_state) * dfa.class_count + symbol_class ];
+  }
+}
+
+
+/*
+ * Description: Runs each of the @count inputs [@begins[ i ], @ends[ i ]) through @dfa and stores the DFA state it
+ *              ends in at @final_dfa_states[ i ]. A single scan is a chain of dependent loads, so instead @lanes
+ *              inputs are advanced in lockstep, each lane prefetching the transition row it needs next; their cache
+ *              misses then overlap. A lane that finishes its input takes up the next one.
+ * Parameters:
+ *    @const CompiledAutomaton &automaton     : The automaton @dfa was compiled from.
+ *    @const Dfa &dfa                         : The DFA.
+ *    @const char *const *begins              : The start of each input.
+ *    @const char *const *ends                : The end of each input.
+ *    @size_t count                           : The number of inputs.
+ *    @size_t lanes                           : How many inputs to advance at once, at most max_interleaved_lanes.
+ *    @int32_t *final_dfa_states              : Receives the final DFA state of each input.
+ */
+void dfa_run_interleaved(
+        const CompiledAutomaton &automaton,
+        const Dfa &dfa,
+        const char *const *begins,
+        const char *const *ends,
+        size_t count,
+        size_t lanes,
+        int32_t *final_dfa_states
+) {
+  const int32_t *table = dfa.table.data();
+  const size_t class_count = static_cast<size_t>(dfa.class_count);
+  const char *position[ max_interleaved_lanes ], *end[ max_interleaved_lanes ];
+  int32_t state[ max_interleaved_lanes ];
+  size_t input[ max_interleaved_lanes ];
+  size_t active = 0, next_input = 0;
+
+  lanes = std::max( size_t( 1 ), std::min( lanes, max_interleaved_lanes ) );
+
+  while ( active > 0 || next_input < count ) {
+    //Give idle lanes the next inputs; empty inputs finish right away.
+    while ( active < lanes && next_input < count ) {
+      if ( begins[ next_input ] == ends[ next_input ] ) {
+        final_dfa_states[ next_input++ ] = dfa.start;
+        continue;
+      }
+      position[ active ] = begins[ next_input ];
+      end[ active ] = ends[ next_input ];
+      state[ active ] = dfa.start;
+      input[ active++ ] = next_input++;
+    }
+
+    for ( size_t lane = 0; lane < active; ) {
+      const int symbol_class = automaton.byte_class[ static_cast<unsigned char>(*position[ lane ]++) ];
+      state[ lane ] = table[ state[ lane ] * class_count + symbol_class ];
+
+      if ( position[ lane ] != end[ lane ] ) {
+        __builtin_prefetch( &table[ state[ lane ] * class_count ] );
+        lane++;
+        continue;
+      }
+
+      //This lane is done: move the last active lane into its place.
+      final_dfa_states[ input[ lane ] ] = state[ lane ];
+      active--;
+      position[ lane ] = position[ active ];
+      end[ lane ] = end[ active ];
+      state[ lane ] = state[ active ];
+      input[ lane ] = input[ active ];
+    }
+  }
+}
+
+
+/*
+ * Description: Computes where @dfa ends up after reading [@begin, @end) from each of its states, storing the result
+ *              in @mapping. Every state starts out in a lane of its own, but lanes that reach the same state are
+ *              merged for good, and DFAs tend to synchronize quickly, so the speculation soon costs no more than a
+ *              single scan.
+ */
+void dfa_map_chunk(
+        const CompiledAutomaton &automaton,
+        const Dfa &dfa,
+        const char *begin,
+        const char *end,
+        std::vector<int32_t> &mapping
+) {
+  const int32_t *table = dfa.table.data();
+  const size_t class_count = static_cast<size_t>(dfa.class_count);
+  const int32_t state_count = static_cast<int32_t>(dfa.sets.size());
+
+  //lane_of[ s ] is the lane the run started in state s follows; lanes[ l ] is that lane's current state.
+  std::vector<int32_t> lane_of( state_count ), lanes( state_count ), owner( state_count, -1 ), remap( state_count );
+  for ( int32_t s = 0; s < state_count; s++ ) lane_of[ s ] = lanes[ s ] = s;
+
+  const char *position = begin;
+  while ( position != end && lanes.size() > 1 ) {
+    const int symbol_class = automaton.byte_class[ static_cast<unsigned char>(*position++) ];
+
+    //Step every lane, merging the ones which land on a state another lane already holds.
+    size_t kept = 0;
+    for ( size_t lane = 0; lane < lanes.size(); lane++ ) {
+      const int32_t next = table[ lanes[ lane ] * class_count + symbol_class ];
+      if ( owner[ next ] < 0 ) {
+        owner[ next ] = static_cast<int32_t>(kept);
+        lanes[ kept++ ] = next;
+      }
+      remap[ lane ] = owner[ next ];
+    }
+    for ( size_t lane = 0; lane < kept; lane++ ) owner[ lanes[ lane ] ] = -1;
+    if ( kept < lanes.size() )
+      for ( auto &lane : lane_of ) lane = remap[ lane ];
+    lanes.resize( kept );
+  }
+
+  //Once every run has converged, a single scan finishes the chunk.
+  if ( lanes.size() == 1 ) {
+    int32_t state = lanes[ 0 ];
+    for ( ; position != end; position++ )
+      state = table[ state * class_count + automaton.byte_class[ static_cast<unsigned char>(*position) ] ];
+    lanes[ 0 ] = state;
+  }
+
+  mapping.resize( state_count );
+  for ( int32_t s = 0; s < state_count; s++ ) mapping[ s ] = lanes[ lane_of[ s ] ];
+}
+
+/*
+ * Description: Runs one large input [@begin, @end) through @dfa on @thread_count threads, filling @output exactly as
+ *              the stream engine does. The input is cut into one chunk per thread. The first chunk is scanned from
+ *              the start state with dfa_feed(), and every other one speculatively from all states with
+ *              dfa_map_chunk(); the chunks' mappings are then applied in order to find the final state.
+ */
+void dfa_run_parallel(
+        const CompiledAutomaton &automaton,
+        const Dfa &dfa,
+        const char *begin,
+        const char *end,
+        size_t thread_count,
+        Output &output
+) {
+  const size_t min_chunk = size_t( 1 ) << 16;
+  const size_t length = static_cast<size_t>(end - begin);
+  const size_t chunk_count = std::max( size_t( 1 ), std::min( thread_count, length / min_chunk ) );
+  const size_t chunk_length = length / chunk_count;
+
+  int32_t state = dfa.start;
+  std::vector<std::vector<int32_t> > mappings( chunk_count );
+  std::vector<std::thread> workers;
+
+  for ( size_t chunk = 1; chunk < chunk_count; chunk++ ) {
+    const char *chunk_begin = begin + chunk * chunk_length;
+    const char *chunk_end = chunk + 1 == chunk_count ? end : chunk_begin + chunk_length;
+    workers.emplace_back( dfa_map_chunk, std::cref( automaton ), std::cref( dfa ), chunk_begin, chunk_end,
+                          std::ref( mappings[ chunk ] ) );
+  }
+
+  for ( const char *position = begin; position != begin + chunk_length; position++ )
+    state = dfa.table[ state * static_cast<size_t>(dfa.class_count) +
+                       automaton.byte_class[ static_cast<unsigned char>(*position) ] ];
+  if ( chunk_count == 1 )
+    for ( const char *position = begin + chunk_length; position != end; position++ )
+      state = dfa.table[ state * static_cast<size_t>(dfa.class_count) +
+                         automaton.byte_class[ static_cast<unsigned char>(*position) ] ];
+
+  for ( auto &worker : workers ) worker.join();
+  for ( size_t chunk = 1; chunk < chunk_count; chunk++ ) state = mappings[ chunk ][ state ];
+
+  output_state_set( automaton, dfa.sets[ state ], output );
+}
+
+
+/*
+ * Description: Minimizes @dfa by Hopcroft's partition refinement in O(n * k * log n). States start out grouped by
+ *              what a run ending in them reports, and a group is split whenever some symbol sends its members into
+ *              different groups. Each state of the result stands for the union of the NFA state sets it merged.
+ * Parameters:
+ *    @const CompiledAutomaton &automaton     : The automaton @dfa was compiled from.
+ *    @const Dfa &dfa                         : A DFA produced by compile_dfa().
+ *    @bool exact                             : If false, states are only told apart by acceptance, so equivalent
+ *                                              states merge fully but a run reports every NFA state its final DFA
+ *                                              state merged. If true, states also stay apart whenever they would
+ *                                              report different final states, so output matches the unminimized DFA.
+ */
+Dfa minimize_dfa(
+        const CompiledAutomaton &automaton,
+        const Dfa &dfa,
+        bool exact
+) {
+  const int state_count = static_cast<int>(dfa.sets.size());
+  const int symbol_count = dfa.class_count;
+
+  //Predecessors of each state on each symbol, in CSR form: pred[ pred_offsets[ symbol * n + state ] ... ).
+  std::vector<int> pred_offsets( static_cast<size_t>(symbol_count) * state_count + 1, 0 ), pred;
+  for ( int a = 0; a < symbol_count; a++ )
+    for ( int state = 0; state < state_count; state++ )
+      pred_offsets[ a * state_count + dfa.table[ state * symbol_count + a ] + 1 ]++;
+  for ( size_t i = 1; i < pred_offsets.size(); i++ ) pred_offsets[ i ] += pred_offsets[ i - 1 ];
+  pred.resize( pred_offsets.back() );
+  {
+    std::vector<int> fill( pred_offsets.begin(), pred_offsets.end() - 1 );
+    for ( int a = 0; a < symbol_count; a++ )
+      for ( int state = 0; state < state_count; state++ )
+        pred[ fill[ a * state_count + dfa.table[ state * symbol_count + a ] ]++ ] = state;
+  }
+
+  //Refinable partition: each block is a range [first, end) of elems, with its marked members moved to [first, mid).
+  std::vector<int> elems( state_count ), loc( state_count ), block_of( state_count );
+  std::vector<int> first, end, mid;
+
+  std::map<std::vector<int>, int> initial_blocks;
+  for ( int state = 0; state < state_count; state++ ) {
+    std::vector<int> key{ dfa.accepting[ state ] ? 1 : 0 };
+    if ( exact ) {
+      for_each_state( dfa.sets[ state ], [&](int index) {
+        if ( !dfa.accepting[ state ] || state_set_contains( automaton.accepting, index ) ) key.push_back( index );
+      } );
+    }
+    block_of[ state ] = initial_blocks.emplace( key, static_cast<int>(initial_blocks.size()) ).first->second;
+  }
+
+  const int initial_count = static_cast<int>(initial_blocks.size());
+  first.assign( initial_count, 0 );
+  std::vector<int> sizes( initial_count, 0 );
+  for ( int state = 0; state < state_count; state++ ) sizes[ block_of[ state ] ]++;
+  for ( int block = 1; block < initial_count; block++ ) first[ block ] = first[ block - 1 ] + sizes[ block - 1 ];
+  end = first;
+  for ( int state = 0; state < state_count; state++ ) {
+    loc[ state ] = end[ block_of[ state ] ]++;
+    elems[ loc[ state ] ] = state;
+  }
+  mid = first;
+
+  //Every (block, symbol) pair still to be used as a splitter. All but one of the initial blocks suffice.
+  std::vector<std::pair<int, int> > worklist;
+  std::vector<bool> in_worklist( static_cast<size_t>(initial_count) * symbol_count, false );
+  int largest = 0;
+  for ( int block = 1; block < initial_count; block++ )
+    if ( end[ block ] - first[ block ] > end[ largest ] - first[ largest ] ) largest = block;
+  for ( int block = 0; block < initial_count; block++ ) {
+    if ( block == largest ) continue;
+    for ( int a = 0; a < symbol_count; a++ ) {
+      worklist.emplace_back( block, a );
+      in_worklist[ block * symbol_count + a ] = true;
+    }
+  }
+
+  std::vector<int> splitter, touched;
+  while ( !worklist.empty() ) {
+    const int splitter_block = worklist.back().first, a = worklist.back().second;
+    worklist.pop_back();
+    in_worklist[ splitter_block * symbol_count + a ] = false;
+
+    splitter.assign( elems.begin() + first[ splitter_block ], elems.begin() + end[ splitter_block ] );
+    for ( const int target : splitter ) {
+      for ( int i = pred_offsets[ a * state_count + target ]; i < pred_offsets[ a * state_count + target + 1 ]; i++ ) {
+        const int state = pred[ i ], block = block_of[ state ];
+        if ( loc[ state ] < mid[ block ] ) continue;
+        if ( mid[ block ] == first[ block ] ) touched.push_back( block );
+
+        const int swapped = elems[ mid[ block ] ];
+        std::swap( elems[ loc[ state ] ], elems[ mid[ block ] ] );
+        loc[ swapped ] = loc[ state ];
+        loc[ state ] = mid[ block ]++;
+      }
+    }
+
+    for ( const int block : touched ) {
+      if ( mid[ block ] == end[ block ] ) {
+        mid[ block ] = first[ block ];
+        continue;
+      }
+
+      //The marked members [first, mid) become a new block; the rest stay behind.
+      const int split = static_cast<int>(first.size());
+      first.push_back( first[ block ] );
+      end.push_back( mid[ block ] );
+      mid.push_back( first[ block ] );
+      first[ block ] = mid[ block ];
+      for ( int i = first[ split ]; i < end[ split ]; i++ ) block_of[ elems[ i ] ] = split;
+      in_worklist.resize( first.size() * symbol_count, false );
+
+      const bool split_is_smaller = end[ split ] - first[ split ] <= end[ block ] - first[ block ];
+      for ( int c = 0; c < symbol_count; c++ ) {
+        const int added = in_worklist[ block * symbol_count + c ] || split_is_smaller ? split : block;
+        if ( in_worklist[ added * symbol_count + c ] ) continue;
+        worklist.emplace_back( added, c );
+        in_worklist[ added * symbol_count + c ] = true;
+      }
+    }
+    touched.clear();
+  }
+
+  Dfa minimized;
+  const int block_count = static_cast<int>(first.size());
+  minimized.start = block_of[ dfa.start ];
+  minimized.class_count = symbol_count;
+  minimized.table.assign( static_cast<size_t>(block_count) * symbol_count, -1 );
+  minimized.accepting.assign( block_count, false );
+  minimized.sets.assign( block_count, make_state_set( automaton.state_count ) );
+
+  for ( int state = 0; state < state_count; state++ ) {
+    const int block = block_of[ state ];
+    if ( minimized.table[ block * symbol_count ] < 0 )
+      for ( int a = 0; a < symbol_count; a++ )
+        minimized.table[ block * symbol_count + a ] = block_of[ dfa.table[ state * symbol_count + a ] ];
+    minimized.accepting[ block ] = dfa.accepting[ state ];
+    for ( size_t w = 0; w < dfa.sets[ state ].words.size(); w++ )
+      minimized.sets[ block ].words[ w ] |= dfa.sets[ state ].words[ w ];
+  }
+
+  return minimized;
+}
+
+
+//Largest DFA compile_jit() will translate; past this the code outgrows the instruction cache and the table walk wins.
+const size_t max_jit_states = 4096;
+
+//States that leave at most this many bytes off their most common target test them one by one rather than by table.
+const int max_jit_compares = 6;
+
+/*
+ * A minimal x86-64 assembler for compile_jit(): raw bytes, plus 32-bit displacements to labels that are patched once
+ * every label's position is known. Every jump and data reference is relative, so the code runs wherever it is copied.
+ */
+struct JitAssembler {
+    std::vector<uint8_t> code;
+    std::vector<size_t> labels;                           // <int label, offset>
+    std::vector<std::pair<size_t, int> > relative;        // <offset of a rel32 ending its instruction, int label>
+    std::vector<std::pair<size_t, int> > table_entries;   // <offset of a jump table entry, int label>
+    std::vector<size_t> table_bases;                      // <offset of the table each entry is relative to>
+};
+
+void jit_emit(JitAssembler &assembler, std::initializer_list<uint8_t> bytes) {
+  assembler.code.insert( assembler.code.end(), bytes.begin(), bytes.end() );
+}
+
+void jit_emit_rel32(JitAssembler &assembler, int label) {
+  assembler.relative.emplace_back( assembler.code.size(), label );
+  jit_emit( assembler, { 0, 0, 0, 0 } );
+}
+
+void jit_bind(JitAssembler &assembler, int label) {
+  assembler.labels[ label ] = assembler.code.size();
+}
+
+void jit_store32(std::vector<uint8_t> &code, size_t offset, int64_t value) {
+  const int32_t value32 = static_cast<int32_t>(value);
+  std::memcpy( &code[ offset ], &value32, 4 );
+}
+
+/*
+ * Description: Translates @dfa into x86-64 machine code in @jit. Every DFA state becomes a block that returns at the
+ *              end of the input, otherwise loads the next byte and jumps to the next state's block: through a chain
+ *              of compares when the state leaves few bytes off one common target, else through a jump table over
+ *              the symbol classes. A state that every byte leaves unchanged returns at once. The blocks are listed
+ *              in /tmp/perf-<pid>.map, so that profilers can name them. Returns false, leaving @jit empty, on a
+ *              CPU other than x86-64, when the DFA has more than max_jit_states states, or if no executable memory
+ *              can be had.
+ */
+bool compile_jit(
+        const CompiledAutomaton &automaton,
+        const Dfa &dfa,
+        JitDfa &jit
+) {
+#if defined(__x86_64__)
+  const int state_count = static_cast<int>(dfa.sets.size());
+  const int class_count = dfa.class_count;
+  if ( static_cast<size_t>(state_count) > max_jit_states ) return false;
+
+  //Labels: each state's block, then each state's exit, then the data: byte classes, entry table, class tables.
+  const int exit_label = state_count, byte_class_label = 2 * state_count, entry_table_label = byte_class_label + 1;
+  const int class_table_label = entry_table_label + 1;
+  JitAssembler assembler;
+  assembler.labels.assign( class_table_label + state_count, 0 );
+  std::vector<bool> uses_table( state_count, false );
+
+  //Entry, as int32_t run(rdi = begin, rsi = end, edx = state): r8 = byte classes, then jump to the state's block.
+  jit_emit( assembler, { 0x4C, 0x8D, 0x05 } );                    // lea r8, [rip + byte classes]
+  jit_emit_rel32( assembler, byte_class_label );
+  jit_emit( assembler, { 0x89, 0xD2 } );                          // mov edx, edx
+  jit_emit( assembler, { 0x48, 0x8D, 0x0D } );                    // lea rcx, [rip + entry table]
+  jit_emit_rel32( assembler, entry_table_label );
+  jit_emit( assembler, { 0x48, 0x63, 0x04, 0x91 } );              // movsxd rax, dword [rcx + rdx * 4]
+  jit_emit( assembler, { 0x48, 0x01, 0xC8, 0xFF, 0xE0 } );        // add rax, rcx; jmp rax
+  const size_t entry_bytes = assembler.code.size();
+
+  for ( int state = 0; state < state_count; state++ ) {
+    const int32_t *row = &dfa.table[ static_cast<size_t>(state) * class_count ];
+    std::vector<int> byte_target( 256 ), uses( state_count, 0 );
+    for ( int byte = 0; byte < 256; byte++ ) uses[ byte_target[ byte ] = row[ automaton.byte_class[ byte ] ] ]++;
+    const int fallback = static_cast<int>(std::max_element( uses.begin(), uses.end() ) - uses.begin());
+
+    jit_bind( assembler, state );
+    if ( uses[ state ] == 256 ) {
+      jit_bind( assembler, exit_label + state );
+      jit_emit( assembler, { 0xB8, 0, 0, 0, 0, 0xC3 } );          // mov eax, state; ret
+      jit_store32( assembler.code, assembler.code.size() - 5, state );
+      continue;
+    }
+
+    jit_emit( assembler, { 0x48, 0x39, 0xF7, 0x0F, 0x83 } );      // cmp rdi, rsi; jae exit
+    jit_emit_rel32( assembler, exit_label + state );
+    jit_emit( assembler, { 0x0F, 0xB6, 0x07, 0x48, 0xFF, 0xC7 } ); // movzx eax, byte [rdi]; inc rdi
+
+    if ( 256 - uses[ fallback ] <= max_jit_compares ) {
+      for ( int byte = 0; byte < 256; byte++ ) {
+        if ( byte_target[ byte ] == fallback ) continue;
+        jit_emit( assembler, { 0x3C, static_cast<uint8_t>(byte), 0x0F, 0x84 } );  // cmp al, byte; je target
+        jit_emit_rel32( assembler, byte_target[ byte ] );
+      }
+      jit_emit( assembler, { 0xE9 } );                            // jmp fallback
+      jit_emit_rel32( assembler, fallback );
+    } else {
+      uses_table[ state ] = true;
+      jit_emit( assembler, { 0x41, 0x0F, 0xB6, 0x04, 0x00 } );    // movzx eax, byte [r8 + rax]
+      jit_emit( assembler, { 0x48, 0x8D, 0x0D } );                // lea rcx, [rip + class table]
+      jit_emit_rel32( assembler, class_table_label + state );
+      jit_emit( assembler, { 0x48, 0x63, 0x04, 0x81 } );          // movsxd rax, dword [rcx + rax * 4]
+      jit_emit( assembler, { 0x48, 0x01, 0xC8, 0xFF, 0xE0 } );    // add rax, rcx; jmp rax
+    }
+
+    jit_bind( assembler, exit_label + state );
+    jit_emit( assembler, { 0xB8, 0, 0, 0, 0, 0xC3 } );            // mov eax, state; ret
+    jit_store32( assembler.code, assembler.code.size() - 5, state );
+  }
+
+  const auto add_table = [&](int label, int count, std::function<int(int)> target) {
+    while ( assembler.code.size() % 4 ) assembler.code.push_back( 0xCC );
+    jit_bind( assembler, label );
+    for ( int i = 0; i < count; i++ ) {
+      assembler.table_bases.push_back( assembler.labels[ label ] );
+      assembler.table_entries.emplace_back( assembler.code.size(), target( i ) );
+      jit_emit( assembler, { 0, 0, 0, 0 } );
+    }
+  };
+  jit_bind( assembler, byte_class_label );
+  assembler.code.insert( assembler.code.end(), automaton.byte_class.begin(), automaton.byte_class.end() );
+  add_table( entry_table_label, state_count, [](int state) { return state; } );
+  for ( int state = 0; state < state_count; state++ )
+    if ( uses_table[ state ] )
+      add_table( class_table_label + state, class_count, [&](int symbol_class) {
+        return dfa.table[ static_cast<size_t>(state) * class_count + symbol_class ];
+      } );
+
+  for ( const auto &fixup : assembler.relative )
+    jit_store32( assembler.code, fixup.first,
+                 static_cast<int64_t>(assembler.labels[ fixup.second ]) - static_cast<int64_t>(fixup.first + 4) );
+  for ( size_t i = 0; i < assembler.table_entries.size(); i++ )
+    jit_store32( assembler.code, assembler.table_entries[ i ].first,
+                 static_cast<int64_t>(assembler.labels[ assembler.table_entries[ i ].second ]) -
+                 static_cast<int64_t>(assembler.table_bases[ i ]) );
+
+  //Written while writable, then made executable and read-only, so the memory is never both.
+  void *memory = mmap( nullptr, assembler.code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+  if ( memory == MAP_FAILED ) return false;
+  std::memcpy( memory, assembler.code.data(), assembler.code.size() );
+  if ( mprotect( memory, assembler.code.size(), PROT_READ | PROT_EXEC ) != 0 ) {
+    munmap( memory, assembler.code.size() );
+    return false;
+  }
+
+  const uintptr_t base = reinterpret_cast<uintptr_t>(memory);
+  const std::string map_name = "/tmp/perf-" + std::to_string( getpid() ) + ".map";
+  if ( FILE *map = fopen( map_name.c_str(), "a" ) ) {
+    fprintf( map, "%lx %lx fsa_jit_entry\n", static_cast<unsigned long>(base),
+             static_cast<unsigned long>(entry_bytes) );
+    for ( int state = 0; state < state_count; state++ ) {
+      const size_t end = assembler.labels[ state + 1 < state_count ? state + 1 : byte_class_label ];
+      fprintf( map, "%lx %lx fsa_jit_state_%d\n", static_cast<unsigned long>(base + assembler.labels[ state ]),
+               static_cast<unsigned long>(end - assembler.labels[ state ]), state );
+    }
+    fclose( map );
+  }
+
+  jit.run = reinterpret_cast<JitDfa::Function>(memory);
+  jit.code_bytes = assembler.code.size();
+  return true;
+#else
+  (void) automaton;
+  (void) dfa;
+  (void) jit;
+  return false;
+#endif
+}
+
+
+/*
+ * Description: Builds the DFA of @compiled into @dfa, minimized if --minimize was given, reporting its statistics on
+ *              stderr if --verbose was given. Returns false, with the reason in @error, if it outgrows
+ *              --max-dfa-states.
+ */
+bool build_dfa(
+        const CompiledAutomaton &compiled,
+        const Options &options,
+        Dfa &dfa,
+        std::string &error
+) {
+  if ( !compile_dfa( compiled, options.max_dfa_states, dfa ) ) {
+    error = "The DFA needs more than " + std::to_string( options.max_dfa_states ) + " states.";
+    return false;
+  }
+  if ( options.verbose )
+    std::cerr << "DFA:\t " << dfa.sets.size() << " states, " << dfa.class_count << " symbol classes, "
+              << dfa.table.size() * sizeof( int32_t ) << " bytes of transition table" << "\n";
+  if ( !options.minimize.empty() ) {
+    dfa = minimize_dfa( compiled, dfa, options.minimize == "exact" );
+    if ( options.verbose ) std::cerr << "Minimized DFA:\t " << dfa.sets.size() << " states" << "\n";
+  }
+  return true;
+}
+
+/*
+ * Description: Builds the engine requested by @options for @compiled into @engine, reporting its statistics on
+ *              stderr if --verbose was given. Returns false, with the reason in @error, if the DFA outgrows
+ *              --max-dfa-states.
+ */
+bool make_engine(
+        const CompiledAutomaton &compiled,
+        const Options &options,
+        Engine &engine,
+        std::string &error
+) {
+  engine.automaton = &compiled;
+
+  if ( options.verbose )
+    std::cerr << "Automaton:\t " << compiled.state_count << " states, " << compiled.class_count << " symbol classes, "
+              << ( compiled.successor_sets.empty() ? "sparse" : "bitset" ) << " successors, " << simd_kernels.name
+              << " kernels" << "\n";
+
+  if ( options.engine == "matrix" ) {
+    engine.kind = Engine::matrix;
+  } else if ( options.engine == "lazy" ) {
+    engine.kind = Engine::lazy;
+    engine.lazy_dfa = make_lazy_dfa( compiled, options.dfa_cache_bytes );
+  } else if ( options.engine == "dfa" ) {
+    engine.kind = Engine::dfa;
+    engine.lanes = options.interleave;
+    if ( !build_dfa( compiled, options, engine.full_dfa, error ) ) return false;
+  } else if ( options.engine == "jit" ) {
+    if ( !build_dfa( compiled, options, engine.full_dfa, error ) ) return false;
+    engine.kind = Engine::jit;
+    if ( !compile_jit( compiled, engine.full_dfa, engine.jit_dfa ) ) {
+      engine.kind = Engine::dfa;
+      engine.lanes = options.interleave;
+      if ( options.verbose ) std::cerr << "JIT:\t unavailable, running the DFA tables instead" << "\n";
+    } else if ( options.verbose ) {
+      std::cerr << "JIT:\t " << engine.jit_dfa.code_bytes << " bytes of machine code" << "\n";
+    }
+  } else if ( options.engine == "nfa" && compiled.state_count <= 64 ) {
+    engine.kind = Engine::bit_parallel;
+    engine.narrow = make_bit_parallel_nfa<uint64_t>( compiled );
+  } else if ( options.engine == "nfa" && compiled.state_count <= static_cast<int>(sizeof( WideWord ) * 8) ) {
+    engine.kind = Engine::wide_bit_parallel;
+    engine.wide = make_bit_parallel_nfa<WideWord>( compiled );
+  }
+
+  return true;
+}
+
+
+/*
+ * Description: Resets @stream to the start of a new input for @engine.
+ */
+void engine_stream_begin(
+        Engine &engine,
+        EngineStream &stream
+) {
+  switch ( engine.kind ) {
+    case Engine::bit_parallel:
+      stream.narrow = engine.narrow.start;
+      break;
+    case Engine::wide_bit_parallel:
+      stream.wide = engine.wide.start;
+      break;
+    case Engine::lazy:
+      stream.dfa_state = lazy_dfa_start( engine.lazy_dfa );
+      break;
+    case Engine::dfa:
+    case Engine::jit:
+      stream.dfa_state = engine.full_dfa.start;
+      break;
+    default:
+      stream.current = engine.automaton->start;
+      stream.next = stream.current;
+  }
+}
+
+/*
+ * Description: Feeds the next piece [@begin, @end) of the input to @engine. The matrix engine needs the whole input
+ *              at once, so here it steps the frontier like the default engine.
+ */
+void engine_stream_feed(
+        Engine &engine,
+        EngineStream &stream,
+        const char *begin,
+        const char *end
+) {
+  const CompiledAutomaton &compiled = *engine.automaton;
+
+  switch ( engine.kind ) {
+    case Engine::bit_parallel:
+      bit_parallel_feed( compiled, engine.narrow, stream.narrow, begin, end );
+      break;
+    case Engine::wide_bit_parallel:
+      bit_parallel_feed( compiled, engine.wide, stream.wide, begin, end );
+      break;
+    case Engine::lazy:
+      lazy_dfa_feed( engine.lazy_dfa, stream.dfa_state, begin, end );
+      break;
+    case Engine::dfa:
+      dfa_feed( compiled, engine.full_dfa, stream.dfa_state, begin, end );
+      break;
+    case Engine::jit:
+      stream.dfa_state = engine.jit_dfa.run( begin, end, stream.dfa_state );
+      break;
+    default:
+      frontier_feed( compiled, stream.current, stream.next, begin, end );
+  }
+}
+
+/*
+ * Description: Ends the input fed to @stream, filling @output with the final states and acceptance.
+ */
+void engine_stream_finish(
+        Engine &engine,
+        EngineStream &stream,
+        Output &output
+) {
+  const CompiledAutomaton &compiled = *engine.automaton;
+
+  switch ( engine.kind ) {
+    case Engine::bit_parallel:
+      bit_parallel_output( compiled, engine.narrow, stream.narrow, output );
+      break;
+    case Engine::wide_bit_parallel:
+      bit_parallel_output( compiled, engine.wide, stream.wide, output );
+      break;
+    case Engine::lazy:
+      output_state_set( compiled, engine.lazy_dfa.sets[ stream.dfa_state ], output );
+      break;
+    case Engine::dfa:
+    case Engine::jit:
+      output_state_set( compiled, engine.full_dfa.sets[ stream.dfa_state ], output );
+      break;
+    default:
+      output_state_set( compiled, stream.current, output );
+  }
+}
+
+/*
+ * Description: Runs @input_string through @engine, filling @output with the final states and acceptance.
+ */
+void engine_run(
+        Engine &engine,
+        const std::string &input_string,
+        Output &output
+) {
+  EngineStream stream;
+  engine_stream_begin( engine, stream );
+  engine_stream_feed( engine, stream, input_string.data(), input_string.data() + input_string.size() );
+  engine_stream_finish( engine, stream, output );
+}
+
+/*
+ * The tables behind a Matcher: a minimized DFA and, for each of its states, the ids a run ending there reports.
+ */
+struct MatcherTables {
+    std::array<uint8_t, 256> byte_class;  // <unsigned char byte, uint8_t class>
+    size_t class_count = 0;
+    int32_t start = 0;
+    std::vector<int32_t> table;           // <dfa state * class_count + class, int dfa state>
+    std::vector<uint8_t> accepting;       // <int dfa state, bool accepts>
+    std::vector<size_t> result_offsets;   // <int dfa state, first index into result_ids>, plus an end
+    std::vector<int32_t> result_ids;
+};
+
+}  // namespace internal
+
+Automaton Automaton::load(const std::string &path, size_t thread_count) {
+  //The bitset kernels are chosen once, for every automaton this process compiles.
+  static const bool kernels_selected = internal::select_simd_kernels( "auto" );
+  (void) kernels_selected;
+
+  internal::CompiledAutomaton compiled;
+  std::string error;
+  if ( !internal::load_compiled( path, compiled, error ) ) {
+    if ( !error.empty() ) throw Error( error );
+    internal::Automaton automaton;
+    if ( !internal::parse_file( path, thread_count, automaton, error ) ) throw Error( error );
+    internal::config_start_and_accept_states( automaton );
+    if ( !internal::compile_automaton( automaton, compiled, error ) ) throw Error( error );
+  }
+
+  Automaton loaded;
+  loaded.compiled = std::make_shared<const internal::CompiledAutomaton>( std::move( compiled ) );
+  return loaded;
+}
+
+/*
+ * Description: Builds the exactly minimized DFA, whose states still report the same final states as the unminimized
+ *              one, and works out once per DFA state what a run ending there reports, so that match() only has to
+ *              walk the table.
+ */
+Matcher Automaton::compile(size_t max_dfa_states) const {
+  internal::Options options;
+  options.max_dfa_states = max_dfa_states;
+  options.minimize = "exact";
+  internal::Dfa dfa;
+  std::string error;
+  if ( !internal::build_dfa( *compiled, options, dfa, error ) ) throw Error( error );
+
+  auto tables = std::make_shared<internal::MatcherTables>();
+  tables->byte_class = compiled->byte_class;
+  tables->class_count = static_cast<size_t>(dfa.class_count);
+  tables->start = dfa.start;
+  tables->table = std::move( dfa.table );
+  tables->result_offsets.push_back( 0 );
+
+  for ( const auto &set : dfa.sets ) {
+    internal::Output output;
+    internal::output_state_set( *compiled, set, output );
+    std::sort( output.final_states.begin(), output.final_states.end() );
+    output.final_states.erase( std::unique( output.final_states.begin(), output.final_states.end() ),
+                               output.final_states.end() );
+
+    for ( const int id : output.final_states )
+      if ( !output.is_accept || std::binary_search( compiled->accept_ids.begin(), compiled->accept_ids.end(), id ) )
+        tables->result_ids.push_back( id );
+    tables->accepting.push_back( output.is_accept );
+    tables->result_offsets.push_back( tables->result_ids.size() );
+  }
+
+  Matcher matcher;
+  matcher.tables = std::move( tables );
+  return matcher;
+}
+
+int Automaton::state_count() const {
+  return compiled->state_count;
+}
+
+
+Result Matcher::match(std::string_view input) const noexcept {
+  const internal::MatcherTables &dfa = *tables;
+  const int32_t *table = dfa.table.data();
+  size_t state = static_cast<size_t>(dfa.start);
+  for ( const char c : input )
+    state = static_cast<size_t>(table[ state * dfa.class_count + dfa.byte_class[ static_cast<unsigned char>(c) ] ]);
+
+  Result result;
+  result.accepted = dfa.accepting[ state ];
+  result.final_states = dfa.result_ids.data() + dfa.result_offsets[ state ];
+  result.final_state_count = dfa.result_offsets[ state + 1 ] - dfa.result_offsets[ state ];
+  return result;
+}
+
+int Matcher::state_count() const {
+  return static_cast<int>(tables->accepting.size());
+}
+
+}  // namespace fsa
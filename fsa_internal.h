@@ -0,0 +1,269 @@
+/*
+ * Description: The internals of libfsa: the automaton representations, the engines and the functions that load and
+ *              run them. Shared by the library (fsa.cpp) and the simulator's command line (main.cpp), which needs
+ *              more control over its engines than the public interface of fsa.h offers. Nothing here is part of
+ *              that interface, so unlike include/, this header is not on the include path of libfsa's users.
+ */
+
+#ifndef FSA_INTERNAL_H
+#define FSA_INTERNAL_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace fsa {
+namespace internal {
+
+/*
+ * A state line of a specification.
+ */
+struct State {
+    bool is_accept = false;
+    bool is_start = false;
+    int id = 0;
+};
+
+/*
+ * A transition of an Automaton between dense state indices. Single-byte symbols are coded by their byte and longer
+ * ones, such as epsilon, by 256 plus their index in Automaton::symbols.
+ */
+struct Transition {
+    int32_t source;
+    int32_t target;
+    uint32_t symbol;
+};
+
+/*
+ * A set of automaton states, stored as a bitset over the dense indices of Automaton::states.
+ */
+struct StateSet {
+    std::vector<uint64_t> words;
+};
+
+/*
+ * An automaton as read from its specification. States are renamed to the dense indices [0, state_ids.size()) in
+ * order of first appearance; their ids, which may be any ints, are kept only in state_ids, for reporting.
+ */
+struct Automaton {
+    std::vector<int32_t> state_ids;           // <int dense index, int id>
+    StateSet start_states;
+    StateSet accept_states;
+    std::unordered_map<int, int> state_index; // <int id, int dense index>; only kept while loading
+    std::vector<std::string> symbols;         // <symbol code - 256, symbol> for the symbols longer than one byte
+    std::vector<Transition> transitions;      // Sorted by (source, symbol); each pair's targets in file order.
+    std::vector<size_t> transition_offsets;   // <int dense index, first index into transitions>, plus an end
+    int start_index = -1;
+    std::vector<int> epsilon_closure_of;      // <int dense index, int index into epsilon_closures, or -1 if trivial>
+    std::vector<StateSet> epsilon_closures;
+};
+
+struct Output {
+    bool is_accept = false;
+    std::vector<int> final_states;
+};
+
+/*
+ * A read-only memory mapping of a whole file.
+ */
+struct MappedFile {
+    const char *data = nullptr;
+    size_t size = 0;
+};
+
+/*
+ * A read-only view of count elements stored elsewhere, in a vector or in a mapped file.
+ */
+template<typename T>
+struct ArrayView {
+    const T *items = nullptr;
+    size_t count = 0;
+
+    const T &operator[](size_t index) const { return items[ index ]; }
+    const T *begin() const { return items; }
+    const T *end() const { return items + count; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+};
+
+/*
+ * The execution form of an Automaton. States are referred to by their dense index and input bytes by their symbol
+ * class. The targets of every (state, class) pair, already closed under epsilon-transitions, lie contiguously in
+ * targets, so a step costs a couple of array loads and never allocates or chases pointers.
+ */
+struct CompiledAutomaton {
+    int state_count = 0;
+    int class_count = 0;
+    std::array<uint8_t, 256> byte_class;  // <unsigned char byte, uint8_t class>; no transition reads class 0
+    ArrayView<uint32_t> offsets;          // <state * class_count + class, first index into targets>, plus an end
+    ArrayView<int32_t> targets;           // Dense state indices.
+    StateSet start;
+    StateSet accepting;
+    ArrayView<int32_t> state_ids;         // <int dense index, int id>
+    ArrayView<int32_t> accept_ids;        // Sorted ids of the accept states, for reporting.
+    size_t set_words = 0;                 // Words in one StateSet of this automaton.
+    ArrayView<uint64_t> successor_sets;   // <(state * class_count + class) * set_words, targets as a bitset>, or empty
+
+    //The views point into one packed image in the .fsab layout: storage when compiled here, else mapping, a loaded
+    //.fsab file that is unmapped with the CompiledAutomaton. A move hands either one over.
+    std::vector<uint64_t> storage;
+    MappedFile mapping;
+
+    CompiledAutomaton() = default;
+    CompiledAutomaton(CompiledAutomaton &&other) noexcept;
+    CompiledAutomaton &operator=(CompiledAutomaton &&other) noexcept;
+    CompiledAutomaton(const CompiledAutomaton &) = delete;
+    ~CompiledAutomaton();
+};
+
+/*
+ * A specialization of the frontier engine for automata whose whole state set fits in one machine word (64 states,
+ * or 128 where the compiler has a 128-bit integer). The successors of every 8-state chunk of the set are
+ * precomputed for each of its 256 values, so a step is one table load per chunk, OR-ed together, with no branches
+ * on which states are active.
+ */
+template<typename Word>
+struct BitParallelNfa {
+    int class_count = 0;
+    int chunk_count = 0;
+    Word start = 0;
+    Word accepting = 0;
+    std::vector<Word> successors;         // <(chunk * class_count + class) * 256 + chunk value, Word successors>
+};
+
+#ifdef __SIZEOF_INT128__
+typedef unsigned __int128 WideWord;
+#else
+typedef uint64_t WideWord;
+#endif
+
+struct StateSetHash {
+    size_t operator()(const StateSet &set) const {
+      uint64_t hash = 14695981039346656037ULL;
+      for ( const auto word : set.words ) hash = ( hash ^ word ) * 1099511628211ULL;
+      return static_cast<size_t>(hash);
+    }
+};
+
+struct StateSetEqual {
+    bool operator()(const StateSet &lhs, const StateSet &rhs) const { return lhs.words == rhs.words; }
+};
+
+/*
+ * A DFA that is determinized on the fly from an Automaton. Each set of active NFA states met while scanning is
+ * interned as a DFA state the first time it appears, and its successor on each class is computed once and cached in
+ * a flat table, so after warm-up nearly every step is a single load. Once the cache grows past cache_limit bytes it
+ * is cleared and rebuilt from the states still in use, which bounds memory no matter how large the powerset is.
+ */
+struct LazyDfa {
+    enum : int32_t { unknown = -1 };
+
+    const CompiledAutomaton *automaton = nullptr;
+    size_t cache_limit = 0;
+    size_t cache_bytes = 0;
+    int start = unknown;
+    std::vector<StateSet> sets;                                        // <int dfa state, StateSet nfa states>
+    std::vector<int32_t> table;                                // <dfa state * class_count + class, int dfa state>
+    std::unordered_map<StateSet, int, StateSetHash, StateSetEqual> ids;
+};
+
+/*
+ * A DFA built ahead of time from an Automaton by the powerset construction. Each DFA state records the set of NFA
+ * states it stands for, so the final states of a run can still be reported by their original ids.
+ */
+struct Dfa {
+    int start = 0;
+    int class_count = 0;
+    std::vector<int32_t> table;                                // <dfa state * class_count + class, int dfa state>
+    std::vector<bool> accepting;
+    std::vector<StateSet> sets;                                        // <int dfa state, StateSet nfa states>
+};
+
+//Most input strings dfa_run_interleaved() advances at once.
+const size_t max_interleaved_lanes = 16;
+
+/*
+ * A DFA compiled to x86-64 machine code by compile_jit(). run( begin, end, state ) advances the DFA state @state over
+ * the bytes [begin, end) and returns the state it ends in. The code is kept for the life of the process.
+ */
+struct JitDfa {
+    typedef int32_t (*Function)(const char *begin, const char *end, int32_t state);
+
+    Function run = nullptr;
+    size_t code_bytes = 0;
+};
+
+struct Options {
+    std::string engine = "nfa";
+    size_t dfa_cache_bytes = size_t( 64 ) << 20;
+    size_t max_dfa_states = 100000;
+    std::string minimize;
+    std::string simd = "auto";
+    std::string batch;
+    std::string input;
+    size_t threads = 1;
+    size_t interleave = 8;
+    bool verbose = false;
+};
+
+/*
+ * The engine chosen by the options, ready to run any number of input strings against one compiled automaton.
+ */
+struct Engine {
+    enum Kind { frontier, bit_parallel, wide_bit_parallel, matrix, lazy, dfa, jit };
+
+    Kind kind = frontier;
+    const CompiledAutomaton *automaton = nullptr;
+    BitParallelNfa<uint64_t> narrow;
+    BitParallelNfa<WideWord> wide;
+    LazyDfa lazy_dfa;
+    Dfa full_dfa;
+    JitDfa jit_dfa;
+    size_t lanes = 1;                     // Inputs a batch advances at once; only the dfa engine interleaves.
+};
+
+/*
+ * What one input has left behind in an engine so far: the frontier or DFA state it has reached. This is all that
+ * has to be kept between pieces of an input, so a stream of any length is checked in constant memory.
+ */
+struct EngineStream {
+    StateSet current, next;               // frontier engine
+    uint64_t narrow = 0;                  // bit_parallel engine
+    WideWord wide = 0;                    // wide_bit_parallel engine
+    int dfa_state = 0;                    // lazy and dfa engines
+};
+
+//Mapped input files; see fsa.cpp.
+bool map_file(int fd, MappedFile &mapped);
+void unmap_file(MappedFile &mapped);
+
+//Reading and compiling automata.
+bool parse_file(const std::string &file_name, size_t thread_count, Automaton &automaton, std::string &error);
+void config_start_and_accept_states(Automaton &automaton);
+bool compile_automaton(const Automaton &automaton, CompiledAutomaton &compiled, std::string &error);
+bool write_compiled(const CompiledAutomaton &compiled, const std::string &file_name);
+bool load_compiled(const std::string &file_name, CompiledAutomaton &compiled, std::string &error);
+bool select_simd_kernels(const std::string &requested);
+
+//Running automata.
+void output_state_set(const CompiledAutomaton &compiled, const StateSet &final_set, Output &output);
+void nfa_run_matrix(const CompiledAutomaton &compiled, const char *begin, const char *end, size_t thread_count,
+                    Output &output);
+void dfa_run_interleaved(const CompiledAutomaton &automaton, const Dfa &dfa, const char *const *begins,
+                         const char *const *ends, size_t count, size_t lanes, int32_t *final_dfa_states);
+void dfa_run_parallel(const CompiledAutomaton &automaton, const Dfa &dfa, const char *begin, const char *end,
+                      size_t thread_count, Output &output);
+bool build_dfa(const CompiledAutomaton &compiled, const Options &options, Dfa &dfa, std::string &error);
+bool make_engine(const CompiledAutomaton &compiled, const Options &options, Engine &engine, std::string &error);
+void engine_stream_begin(Engine &engine, EngineStream &stream);
+void engine_stream_feed(Engine &engine, EngineStream &stream, const char *begin, const char *end);
+void engine_stream_finish(Engine &engine, EngineStream &stream, Output &output);
+void engine_run(Engine &engine, const std::string &input_string, Output &output);
+
+}  // namespace internal
+}  // namespace fsa
+
+#endif // FSA_INTERNAL_H
@@ -0,0 +1,100 @@
+/*
+ * Description: libfsa, the finite automaton simulator as a library. An Automaton is loaded once, from a
+ *              specification or a compiled .fsab file, and compiled into a Matcher: an immutable DFA that any number
+ *              of threads may share, and that checks an input in a single pass with no allocation.
+ *
+ *                  const fsa::Matcher matcher = fsa::Automaton::load( "protocol.dat" ).compile();
+ *                  const fsa::Result result = matcher.match( message );
+ *                  if ( result.accepted ) ...
+ *
+ *              Failures are thrown as fsa::Error, whose what() tells why.
+ */
+
+#ifndef FSA_H
+#define FSA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace fsa {
+
+namespace internal {
+struct CompiledAutomaton;
+struct MatcherTables;
+}
+
+/*
+ * Thrown when an automaton cannot be loaded or compiled.
+ */
+struct Error : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+/*
+ * What a match reports, as the simulator prints it: whether the input was accepted, and the ids of the accept states
+ * the run ended in if so, else of every state it ended in, in ascending order. final_states points into the Matcher
+ * and stays valid for as long as any copy of that Matcher exists.
+ */
+struct Result {
+    bool accepted = false;
+    const int32_t *final_states = nullptr;
+    size_t final_state_count = 0;
+
+    const int32_t *begin() const { return final_states; }
+    const int32_t *end() const { return final_states + final_state_count; }
+};
+
+/*
+ * A compiled automaton, made only by Automaton::compile(), so that every Matcher has tables. It never changes once
+ * made, so match() may run on any number of threads at once; copies share the same tables. Moving one copies it,
+ * which leaves no empty Matcher behind.
+ */
+class Matcher {
+  public:
+    Matcher(const Matcher &) = default;
+    Matcher &operator=(const Matcher &) = default;
+
+    Result match(std::string_view input) const noexcept;
+    int state_count() const;              // States of the DFA.
+
+  private:
+    friend class Automaton;
+    Matcher() = default;
+    std::shared_ptr<const internal::MatcherTables> tables;
+};
+
+/*
+ * An automaton loaded from a file, made only by Automaton::load(). Copies share the same tables; like a Matcher, it
+ * is copied when moved.
+ */
+class Automaton {
+  public:
+    Automaton(const Automaton &) = default;
+    Automaton &operator=(const Automaton &) = default;
+
+    /*
+     * Description: Loads @path, a .fsab file as written by the compile command or else a specification, which is
+     *              parsed on @thread_count threads if it is large.
+     */
+    static Automaton load(const std::string &path, size_t thread_count = 1);
+
+    /*
+     * Description: Determinizes and minimizes the automaton into a Matcher. Throws fsa::Error if the DFA would need
+     *              more than @max_dfa_states states.
+     */
+    Matcher compile(size_t max_dfa_states = 100000) const;
+
+    int state_count() const;
+
+  private:
+    Automaton() = default;
+    std::shared_ptr<const internal::CompiledAutomaton> compiled;
+};
+
+}  // namespace fsa
+
+#endif // FSA_H
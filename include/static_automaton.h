@@ -0,0 +1,292 @@
+/*
+ * Description: fsa::static_automaton<Spec>, a finite automaton whose specification is known when the program is
+ *              compiled. The text Spec::text, in the same format as the simulator's specification files, is parsed,
+ *              determinized and minimized by the compiler, so the result is a few constant tables and a run starts
+ *              with no setup at all. Header-only; needs C++17.
+ *
+ *                  struct Parity {
+ *                      static constexpr std::string_view text = "state\t0\tstart\taccept\n"
+ *                                                               "transition\t0\t1\t1\n"
+ *                                                               "transition\t1\t1\t0\n"
+ *                                                               "transition\t0\t0\t0\n"
+ *                                                               "transition\t1\t0\t1\n";
+ *                  };
+ *                  static_assert( fsa::static_automaton<Parity>::accepts( "0110" ) );
+ *
+ *              A specification may have at most 64 states and 63 distinct symbols, and its DFA at most 256 states
+ *              before minimization; a specification past these limits, or a malformed one, fails to compile.
+ */
+
+#ifndef FSA_STATIC_AUTOMATON_H
+#define FSA_STATIC_AUTOMATON_H
+
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+
+namespace fsa {
+namespace detail {
+
+constexpr int max_nfa_states = 64;       // Each set of NFA states is one 64-bit mask.
+constexpr int max_symbols = 63;          // Symbol classes are 1 to max_symbols; class 0 is every other byte.
+constexpr int max_dfa_states = 256;
+
+/*
+ * An NFA read from a specification. States are the dense indices of their ids, in order of first appearance.
+ */
+struct Nfa {
+    int state_count = 0;
+    int ids[ max_nfa_states ] = {};
+    uint64_t starts = 0;
+    uint64_t accepting = 0;
+    int symbol_count = 0;
+    uint8_t byte_class[ 256 ] = {};
+    uint64_t targets[ max_nfa_states ][ max_symbols + 1 ] = {};  // <state, class, targets>; later epsilon-closed
+    uint64_t epsilon[ max_nfa_states ] = {};
+};
+
+/*
+ * A DFA with room for max_dfa_states states. Its state 0 is the start state.
+ */
+struct Dfa {
+    int state_count = 0;
+    int class_count = 0;
+    uint8_t byte_class[ 256 ] = {};
+    int table[ max_dfa_states ][ max_symbols + 1 ] = {};
+    bool accepting[ max_dfa_states ] = {};
+};
+
+constexpr std::string_view next_field(std::string_view &line) {
+  const size_t tab = line.find( '\t' );
+  const std::string_view field = line.substr( 0, tab );
+  line = tab == std::string_view::npos ? std::string_view() : line.substr( tab + 1 );
+  return field;
+}
+
+constexpr int parse_id(std::string_view field) {
+  const bool negative = !field.empty() && field[ 0 ] == '-';
+  if ( negative ) field.remove_prefix( 1 );
+  if ( field.empty() ) throw std::invalid_argument( "fsa::static_automaton: a state id is not a number" );
+
+  //The same bounds as the simulator's parser: the magnitude may reach 2^31 only for a negative id.
+  long long value = 0;
+  for ( const char c : field ) {
+    if ( c < '0' || c > '9' ) throw std::invalid_argument( "fsa::static_automaton: a state id is not a number" );
+    value = value * 10 + ( c - '0' );
+    if ( value > ( 1LL << 31 ) ) throw std::invalid_argument( "fsa::static_automaton: a state id is not an int" );
+  }
+  if ( negative ) value = -value;
+  if ( value > 0x7FFFFFFF ) throw std::invalid_argument( "fsa::static_automaton: a state id is not an int" );
+  return static_cast<int>(value);
+}
+
+constexpr int find_or_add_state(Nfa &nfa, int id) {
+  for ( int index = 0; index < nfa.state_count; index++ ) if ( nfa.ids[ index ] == id ) return index;
+  if ( nfa.state_count == max_nfa_states )
+    throw std::length_error( "fsa::static_automaton: the specification has more than 64 states" );
+  nfa.ids[ nfa.state_count ] = id;
+  return nfa.state_count++;
+}
+
+/*
+ * Description: Parses @text into an NFA whose targets are closed under epsilon-transitions. Lines hold
+ *              tab-separated fields, "state ID [start] [accept]" or "transition FROM SYMBOL TO", as in the
+ *              simulator's specification files; other lines are skipped.
+ */
+constexpr Nfa parse(std::string_view text) {
+  Nfa nfa;
+
+  while ( !text.empty() ) {
+    const size_t newline = text.find( '\n' );
+    std::string_view line = text.substr( 0, newline );
+    text = newline == std::string_view::npos ? std::string_view() : text.substr( newline + 1 );
+    if ( !line.empty() && line.back() == '\r' ) line.remove_suffix( 1 );
+
+    const std::string_view keyword = next_field( line );
+    if ( keyword == "state" ) {
+      const int index = find_or_add_state( nfa, parse_id( next_field( line ) ) );
+      while ( !line.empty() ) {
+        const std::string_view flag = next_field( line );
+        if ( flag == "start" ) nfa.starts |= uint64_t( 1 ) << index;
+        if ( flag == "accept" ) nfa.accepting |= uint64_t( 1 ) << index;
+      }
+    } else if ( keyword == "transition" ) {
+      const int source = find_or_add_state( nfa, parse_id( next_field( line ) ) );
+      const std::string_view symbol = next_field( line );
+      const int target = find_or_add_state( nfa, parse_id( next_field( line ) ) );
+
+      if ( symbol == "ε" || symbol == "epsilon" ) {
+        nfa.epsilon[ source ] |= uint64_t( 1 ) << target;
+      } else if ( symbol.size() == 1 ) {
+        uint8_t &symbol_class = nfa.byte_class[ static_cast<unsigned char>(symbol[ 0 ]) ];
+        if ( symbol_class == 0 ) {
+          if ( nfa.symbol_count == max_symbols )
+            throw std::length_error( "fsa::static_automaton: the specification has more than 63 symbols" );
+          symbol_class = static_cast<uint8_t>(++nfa.symbol_count);
+        }
+        nfa.targets[ source ][ symbol_class ] |= uint64_t( 1 ) << target;
+      } else if ( symbol.empty() ) {
+        throw std::invalid_argument( "fsa::static_automaton: a transition has no symbol" );
+      }
+    }
+  }
+
+  //Close every state's epsilon-edges, then every target set, under epsilon-transitions.
+  for ( bool changed = true; changed; ) {
+    changed = false;
+    for ( int state = 0; state < nfa.state_count; state++ ) {
+      uint64_t closure = nfa.epsilon[ state ];
+      for ( int reached = 0; reached < nfa.state_count; reached++ )
+        if ( ( nfa.epsilon[ state ] >> reached ) & 1 ) closure |= nfa.epsilon[ reached ];
+      changed = changed || closure != nfa.epsilon[ state ];
+      nfa.epsilon[ state ] = closure;
+    }
+  }
+  for ( int state = 0; state < nfa.state_count; state++ ) {
+    for ( int symbol_class = 1; symbol_class <= nfa.symbol_count; symbol_class++ ) {
+      uint64_t closed = nfa.targets[ state ][ symbol_class ];
+      for ( int reached = 0; reached < nfa.state_count; reached++ )
+        if ( ( nfa.targets[ state ][ symbol_class ] >> reached ) & 1 ) closed |= nfa.epsilon[ reached ];
+      nfa.targets[ state ][ symbol_class ] = closed;
+    }
+  }
+  return nfa;
+}
+
+/*
+ * Description: Determinizes @nfa by the powerset construction, starting from its first start state as the
+ *              simulator does, then minimizes the DFA by Moore's partition refinement on acceptance.
+ */
+constexpr Dfa determinize(const Nfa &nfa) {
+  Dfa dfa;
+  dfa.class_count = nfa.symbol_count + 1;
+  for ( int byte = 0; byte < 256; byte++ ) dfa.byte_class[ byte ] = nfa.byte_class[ byte ];
+
+  uint64_t sets[ max_dfa_states ] = {};
+  int first_start = 0;
+  while ( first_start < nfa.state_count && !( ( nfa.starts >> first_start ) & 1 ) ) first_start++;
+  if ( first_start < nfa.state_count ) sets[ 0 ] = ( uint64_t( 1 ) << first_start ) | nfa.epsilon[ first_start ];
+  int set_count = 1;
+
+  for ( int state = 0; state < set_count; state++ ) {
+    dfa.accepting[ state ] = ( sets[ state ] & nfa.accepting ) != 0;
+    for ( int symbol_class = 0; symbol_class < dfa.class_count; symbol_class++ ) {
+      uint64_t next = 0;
+      for ( int index = 0; index < nfa.state_count; index++ )
+        if ( ( sets[ state ] >> index ) & 1 ) next |= nfa.targets[ index ][ symbol_class ];
+
+      int found = 0;
+      while ( found < set_count && sets[ found ] != next ) found++;
+      if ( found == set_count ) {
+        if ( set_count == max_dfa_states )
+          throw std::length_error( "fsa::static_automaton: the DFA needs more than 256 states" );
+        sets[ set_count++ ] = next;
+      }
+      dfa.table[ state ][ symbol_class ] = found;
+    }
+  }
+
+  //Moore: split blocks by the blocks their successors lie in until no block splits. Blocks are numbered in order
+  //of their first state, so the start state stays in block 0.
+  int block[ max_dfa_states ] = {}, block_count = 0;
+  for ( int state = 0; state < set_count; state++ ) {
+    int found = 0;
+    while ( found < state && dfa.accepting[ found ] != dfa.accepting[ state ] ) found++;
+    block[ state ] = found < state ? block[ found ] : block_count++;
+  }
+
+  for ( int previous_count = 0; block_count != previous_count; ) {
+    int next_block[ max_dfa_states ] = {}, first_of[ max_dfa_states ] = {};
+    previous_count = block_count;
+    block_count = 0;
+    for ( int state = 0; state < set_count; state++ ) {
+      int found = 0;
+      for ( ; found < block_count; found++ ) {
+        const int other = first_of[ found ];
+        bool same = block[ other ] == block[ state ];
+        for ( int symbol_class = 0; same && symbol_class < dfa.class_count; symbol_class++ )
+          same = block[ dfa.table[ other ][ symbol_class ] ] == block[ dfa.table[ state ][ symbol_class ] ];
+        if ( same ) break;
+      }
+      if ( found == block_count ) first_of[ block_count++ ] = state;
+      next_block[ state ] = found;
+    }
+    for ( int state = 0; state < set_count; state++ ) block[ state ] = next_block[ state ];
+  }
+
+  Dfa minimized;
+  minimized.state_count = block_count;
+  minimized.class_count = dfa.class_count;
+  for ( int byte = 0; byte < 256; byte++ ) minimized.byte_class[ byte ] = dfa.byte_class[ byte ];
+  for ( int state = 0; state < set_count; state++ ) {
+    minimized.accepting[ block[ state ] ] = dfa.accepting[ state ];
+    for ( int symbol_class = 0; symbol_class < dfa.class_count; symbol_class++ )
+      minimized.table[ block[ state ] ][ symbol_class ] = block[ dfa.table[ state ][ symbol_class ] ];
+  }
+  return minimized;
+}
+
+/*
+ * The tables of a static_automaton, sized exactly for its minimal DFA.
+ */
+template<int StateCount, int ClassCount>
+struct Tables {
+    uint8_t byte_class[ 256 ] = {};
+    uint8_t table[ StateCount ][ ClassCount ] = {};
+    bool accepting[ StateCount ] = {};
+};
+
+template<int StateCount, int ClassCount>
+constexpr Tables<StateCount, ClassCount> shrink(const Dfa &dfa) {
+  Tables<StateCount, ClassCount> tables;
+  for ( int byte = 0; byte < 256; byte++ ) tables.byte_class[ byte ] = dfa.byte_class[ byte ];
+  for ( int state = 0; state < StateCount; state++ ) {
+    tables.accepting[ state ] = dfa.accepting[ state ];
+    for ( int symbol_class = 0; symbol_class < ClassCount; symbol_class++ )
+      tables.table[ state ][ symbol_class ] = static_cast<uint8_t>(dfa.table[ state ][ symbol_class ]);
+  }
+  return tables;
+}
+
+}  // namespace detail
+
+/*
+ * The minimal DFA of the specification Spec::text, a std::string_view constant, built entirely at compile time.
+ * Every member is static and constexpr, so an instance carries no state and a run can be evaluated at compile time
+ * or inlined into its caller.
+ */
+template<typename Spec>
+struct static_automaton {
+  private:
+    static constexpr detail::Dfa dfa = detail::determinize( detail::parse( Spec::text ) );
+
+  public:
+    static constexpr int state_count = dfa.state_count;
+    static constexpr int class_count = dfa.class_count;
+    static constexpr int start_state = 0;
+    static constexpr detail::Tables<state_count, class_count> tables =
+            detail::shrink<state_count, class_count>( dfa );
+
+    constexpr static_automaton() = default;
+
+    static constexpr int step(int state, char c) {
+      return tables.table[ state ][ tables.byte_class[ static_cast<unsigned char>(c) ] ];
+    }
+
+    static constexpr int run(std::string_view input, int state = start_state) {
+      for ( const char c : input ) state = step( state, c );
+      return state;
+    }
+
+    static constexpr bool is_accepting(int state) {
+      return tables.accepting[ state ];
+    }
+
+    static constexpr bool accepts(std::string_view input) {
+      return is_accepting( run( input ) );
+    }
+};
+
+}  // namespace fsa
+
+#endif // FSA_STATIC_AUTOMATON_H
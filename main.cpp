@@ -1,353 +1,795 @@
 /*
  * Author:      Jacob Berg
  * Date:        February 10, 2020 @ 7:53 PM
- * Description: This is a program that simulates a partial, nondeterministic finite automaton. We say 'partial', because
- *              epsilon-transitions are not implemented (though, I don't believe it would be such a difficult task).
+ * Description: This is a program that simulates a nondeterministic finite automaton, including epsilon-transitions,
+ *              which are written with the symbol 'ε' (or 'epsilon') in a transition line. The automata are loaded
+ *              and run by libfsa (fsa.cpp); this file is its command line.
  */
 
+#include "fsa_internal.h"
+
 #include <iostream>
 #include <fstream>
 #include <vector>
 #include <algorithm>
-#include <regex>
-#include <map>
-#include <unordered_map>
 #include <iterator>
 #include <string>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <mutex>
+#include <deque>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
 
-struct State {
-    bool is_accept = false;
-    bool is_start = false;
-    int id = 0;
-    std::map<std::string, std::vector<int> > transitions; // <std::string symbol, std::vector<long> end_states>
-};
-
-struct Automaton {
-    State start_state;
-    std::vector<State> accept_states;
-    std::vector<State> states;
-};
-
-struct Output {
-    bool is_accept = false;
-    std::vector<int> final_states;
-};
+using namespace fsa::internal;
 
 
 /*
- * Description: Read input file, line by line to parse definition of finite automaton. Store each line as a split string
- *              in a vector split_string, and then store split_string within data_vector.
- * Parameters:
- *    @std::string original_str               : The string to be split.
- *    @char delim                             : The delimiter an int which to split string.
+ * Description: Reports @error on stderr and halts with exit code 1.
  */
-void parse_file(
-        const std::string &file_name,
-        std::vector<std::string> &data_vector
-) {
-
-  std::ifstream in_file{ file_name };
-  std::string data;
+void halt_with_error(const std::string &error) {
+  std::cerr << "Error:\t " << error << "\n"
+            << "Halting with exit code 1." << "\n";
+  exit( 1 );
+}
 
-  if ( !in_file ) {
-    std::cerr << "Failure in opening file." << "\n"
-              << "Halting with exit code 1." << "\n";
-    exit( 1 );
+/*
+ * Description: Parses a size such as "4096", "512K", "64M" or "2G". Returns false if @text is malformed.
+ */
+bool parse_size(const std::string &text, size_t &size) {
+  size_t end = 0;
+  unsigned long long value;
+  try {
+    value = std::stoull( text, &end );
+  } catch ( const std::exception & ) {
+    return false;
   }
 
-  while ( !in_file.eof() ) {
-    getline( in_file, data );
-    data_vector.push_back( data );
-  }
+  const std::string suffix = text.substr( end );
+  if ( suffix == "K" || suffix == "k" ) value <<= 10;
+  else if ( suffix == "M" || suffix == "m" ) value <<= 20;
+  else if ( suffix == "G" || suffix == "g" ) value <<= 30;
+  else if ( !suffix.empty() ) return false;
 
-  in_file.close();
+  size = static_cast<size_t>(value);
+  return true;
 }
 
+void print_usage() {
+  std::cout << "Usage:\t this_file_name\t [options]\t automaton_specs.txt\tautomaton_config_string" << "\n"
+            << "\t this_file_name\t [options]\t --batch=inputs.txt\tautomaton_specs.txt" << "\n"
+            << "\t this_file_name\t [options]\t --input=input.txt\tautomaton_specs.txt" << "\n"
+            << "\t this_file_name\t compile\t automaton_specs.txt\tautomaton.fsab" << "\n"
+            << "\t this_file_name\t codegen\t automaton_specs.txt\tautomaton_dfa.cpp\t(or fsa-codegen"
+            << " automaton_specs.txt automaton_dfa.cpp)" << "\n"
+            << "A compiled automaton.fsab loads in place of its automaton_specs.txt, with no parsing. codegen writes"
+            << " the DFA as standalone C++ code, in namespace fsa_automaton_dfa." << "\n"
+            << "Options:" << "\n"
+            << "\t--input=FILE\t\t Check the whole of FILE (or of stdin, if FILE is -) as one input string, scanned in"
+            << " place through mmap, or read in pieces from a pipe, so that its size is not limited by memory. One"
+            << " trailing newline is ignored." << "\n"
+            << "\t--batch=FILE\t\t Check every line of FILE (or of stdin, if FILE is -) and print one result per"
+            << " line." << "\n"
+            << "\t--threads=N\t\t Check batch inputs on N threads (0 for one per core; default 1). With"
+            << " --engine=dfa, a single large input is also split across N threads. A large specification is"
+            << " parsed on N threads." << "\n"
+            << "\t--interleave=K\t\t With --engine=dfa, advance K batch inputs (1 to 16; default 8) at once on each"
+            << " thread to overlap their cache misses." << "\n"
+            << "\t--engine=ENGINE\t\t nfa (default) simulates the NFA directly, bit-parallel when its states fit in"
+            << " a machine word; frontier always uses the general bitset frontier; matrix splits a single large input"
+            << " across --threads as boolean transition matrices, for NFAs too big to determinize; lazy uses a lazily"
+            << " built DFA; dfa uses a DFA compiled up front; jit translates that DFA to x86-64 machine code, if it"
+            << " has at most 4096 states." << "\n"
+            << "\t--dfa-cache=BYTES\t Memory cap of the lazy DFA cache, e.g. 64M (default)." << "\n"
+            << "\t--max-dfa-states=N\t Refuse to compile a DFA with more than N states (default 100000)." << "\n"
+            << "\t--minimize[=MODE]\t Minimize the compiled DFA. exact (default) keeps apart states that would"
+            << " report different final states, so output is unchanged; language merges states by acceptance alone,"
+            << " for the smallest DFA, but then the final states reported are an over-approximation: every state"
+            << " any merged DFA state stood for." << "\n"
+            << "\t--simd=KERNELS\t\t Bitset kernels: auto (default), scalar, sse2, avx2 or avx512." << "\n"
+            << "\t--verbose\t\t Report engine statistics on stderr." << "\n";
+}
 
 /*
- * Description: Partitions a given string @original_str by provided delimiter @delim.
- * Parameters:
- *    @std::string original_str               : The string to be split.
- *    @char delim                             : The delimiter along which to split string.
- *    @std::vector<std::string> &split_string : A reference to a vector which will contain the split string.
+ * Description: Separates the --name=value options in @argv from the positional arguments, which are stored in
+ *              @arguments. Halts with exit code 1 on an unknown or malformed option.
  */
-std::vector<std::string> split(
-        const std::string &original_str,
-        const char &delim,
-        std::vector<std::string> &split_string
+void parse_options(
+        int argc,
+        char* argv[],
+        Options &options,
+        std::vector<std::string> &arguments
 ) {
-  std::string spliced_string = original_str;
+  for ( int i = 1; i < argc; i++ ) {
+    const std::string arg = argv[ i ];
 
-  if ( original_str.find_first_of( delim ) == std::string::npos ) {
-    split_string.push_back( original_str );
-    return split_string;
-  } else {
-    split_string.push_back( original_str.substr( 0, original_str.find_first_of( delim ) ) );
-    spliced_string.erase( 0, original_str.find_first_of( delim ) + 1 );
+    if ( arg.compare( 0, 2, "--" ) != 0 ) {
+      arguments.push_back( arg );
+      continue;
+    }
+
+    const size_t equals = arg.find( '=' );
+    const std::string name = arg.substr( 0, equals );
+    const std::string value = equals == std::string::npos ? "" : arg.substr( equals + 1 );
+    bool valid = true;
+
+    if ( name == "--engine" ) {
+      options.engine = value;
+      valid = value == "nfa" || value == "frontier" || value == "matrix" || value == "lazy" || value == "dfa" ||
+              value == "jit";
+    } else if ( name == "--dfa-cache" ) {
+      valid = parse_size( value, options.dfa_cache_bytes );
+    } else if ( name == "--max-dfa-states" ) {
+      valid = parse_size( value, options.max_dfa_states );
+    } else if ( name == "--minimize" ) {
+      options.minimize = value.empty() ? "exact" : value;
+      valid = options.minimize == "exact" || options.minimize == "language";
+    } else if ( name == "--simd" ) {
+      options.simd = value;
+      valid = select_simd_kernels( value );
+    } else if ( name == "--batch" ) {
+      options.batch = value;
+      valid = !value.empty();
+    } else if ( name == "--input" ) {
+      options.input = value;
+      valid = !value.empty();
+    } else if ( name == "--threads" ) {
+      valid = parse_size( value, options.threads );
+      if ( valid && options.threads == 0 ) options.threads = std::max( 1u, std::thread::hardware_concurrency() );
+    } else if ( name == "--interleave" ) {
+      valid = parse_size( value, options.interleave ) && options.interleave >= 1 &&
+              options.interleave <= max_interleaved_lanes;
+    } else if ( name == "--verbose" ) {
+      options.verbose = true;
+      valid = value.empty();
+    } else {
+      valid = false;
+    }
+
+    if ( !valid ) {
+      std::cerr << "Error:\t Unrecognized option " << arg << "\n";
+      print_usage();
+      std::cout << "Halting with exit code 1." << "\n";
+      exit( 1 );
+    }
   }
-  return split( spliced_string, delim, split_string );
 }
 
-
 /*
- * Description: Partitions a given string @original_str by provided delimiter @delim.
- * Parameters:
- *    @std::string original_str               : The string to be split.
- *    @char delim                             : The delimiter along which to split string.
+ * Description: Appends the result line for @output to @line: "accept" followed by the accept states the run ended
+ *              in, or "reject" followed by every state it ended in, each id followed by a space.
  */
-std::vector<std::string> split(
-        const std::string &original_str,
-        const char &delim
+void format_result(
+        const CompiledAutomaton &compiled,
+        Output &output,
+        std::string &line
 ) {
-  std::vector<std::string> split_string;
-  std::string spliced_string = original_str;
+  std::sort( output.final_states.begin(), output.final_states.end() );
+  auto itr = std::unique( output.final_states.begin(), output.final_states.end() );
+  output.final_states.resize(
+          static_cast<unsigned long>(std::distance( output.final_states.begin(), itr ))
+  );
 
-  if ( original_str.find_first_of( delim ) == std::string::npos ) {
-    split_string.push_back( original_str );
-    return split_string;
-  } else {
-    split_string.push_back( original_str.substr( 0, original_str.find_first_of( delim ) ) );
-    spliced_string.erase( 0, original_str.find_first_of( delim ) + 1 );
+  line += output.is_accept ? "accept\t" : "reject\t";
+
+  char digits[ 16 ];
+  for ( const auto &final_state_id : output.final_states ) {
+    if ( output.is_accept &&
+         !std::binary_search( compiled.accept_ids.begin(), compiled.accept_ids.end(), final_state_id ) )
+      continue;
+    const int length = snprintf( digits, sizeof( digits ), "%d ", final_state_id );
+    line.append( digits, static_cast<size_t>(length) );
   }
-  return split( spliced_string, delim, split_string );
 
+  line += "\n";
 }
 
 
 /*
-* Author:      Jacob Berg
-* Date:        February 12, 2020 @ 6:32PM
-* Description: Determines if line read from data read from input file is a state line, then updates
- *             the automata's list of states for each state line. State lines will only consist of
- *             start or accept states.
-*/
-void handle_state_line(
-        Automaton &automaton,
-        std::smatch matches,
-        const std::string &current_line,
-        const std::regex &id_pattern,
-        const std::regex &start_pattern,
-        const std::regex &accept_pattern
+ * Description: Batch mode: checks every newline-delimited input string read from @in against @engine and writes one
+ *              result line per input to stdout, through a large buffer so that output costs no system call per line.
+ */
+void run_batch(
+        Engine &engine,
+        std::istream &in
 ) {
+  const size_t flush_threshold = size_t( 1 ) << 20;
+  std::string input_string, buffer;
+  Output output;
+  buffer.reserve( flush_threshold + 4096 );
 
-  if ( !matches.empty() ) {
-    State new_state;
-    //find id number
-    std::regex_search( current_line, matches, id_pattern );
-    if ( !matches.empty() ) new_state.id = std::stoi( matches.str( 0 ) );
-    //check if start state
-    std::regex_search( current_line, matches, start_pattern );
-    if ( !matches.empty() ) new_state.is_start = true;
-    //check if accept state
-    std::regex_search( current_line, matches, accept_pattern );
-    if ( !matches.empty() ) new_state.is_accept = true;
-
-    //Handle appending new_state to automaton.
-    automaton.states.push_back( new_state );
+  while ( std::getline( in, input_string ) ) {
+    if ( !input_string.empty() && input_string.back() == '\r' ) input_string.pop_back();
+
+    output.is_accept = false;
+    output.final_states.clear();
+    engine_run( engine, input_string, output );
+    format_result( *engine.automaton, output, buffer );
+
+    if ( buffer.size() >= flush_threshold ) {
+      fwrite( buffer.data(), 1, buffer.size(), stdout );
+      buffer.clear();
+    }
   }
 
+  fwrite( buffer.data(), 1, buffer.size(), stdout );
+  fflush( stdout );
 }
 
 
 /*
- * Author:      Jacob Berg
- * Date:        February 12, 2020 @ 11:43PM
- * Description: Determines if line read from data read from input file is a transition line, then updates
- *              the automata's list of transitions for each transition line. If a transition contains a
- *              state which was not already a part of the automata's states, then it adds it to the set of
- *              states.
-*/
-void handle_transition_line(
-        Automaton &automaton,
-        std::smatch matches,
-        const std::regex &transition_function_pattern,
-        const std::string &current_line
+ * Description: Returns the end of the piece of [@begin, @end) that starts at @begin and holds about @bytes bytes of
+ *              whole lines: just past the first newline at or after its @bytes-th byte, or @end.
+ */
+const char *line_aligned_end(
+        const char *begin,
+        const char *end,
+        size_t bytes
 ) {
-  std::vector<std::string> split_line = split( current_line, '\t' );
-
-
-  //Remove word 'transition' from line.
-  split_line.erase( split_line.begin() );
+  if ( static_cast<size_t>(end - begin) <= bytes ) return end;
+  const char *last = begin + bytes - 1;
+  const char *newline = static_cast<const char *>(std::memchr( last, '\n', end - last ));
+  return newline ? newline + 1 : end;
+}
 
-  int begin_state_arg = std::stoi( split_line[ 0 ] ), end_state_arg = std::stoi( split_line[ 2 ] );
-  std::string symbol_arg = split_line[ 1 ];
 
-  std::regex_search( current_line, matches, transition_function_pattern );
+/*
+ * A range [begin, end) of whole batch input lines, checked by one worker and formatted into its own result buffer, so
+ * that results can be written back in input order.
+ */
+struct BatchTask {
+    const char *begin = nullptr;
+    const char *end = nullptr;
+    std::string results;
+};
 
-  //Determine if either of states in current transition are NOT already registered in the automaton.
-  std::vector<int> state_ids;
+/*
+ * A worker's queue of tasks. The owner takes tasks from the front, where the largest ones are, while idle workers
+ * steal from the back.
+ */
+struct WorkerQueue {
+    std::mutex mutex;
+    std::deque<BatchTask *> tasks;
+};
 
-  for ( const auto &current_automaton_state : automaton.states ) state_ids.push_back( current_automaton_state.id );
+/*
+ * Description: Checks every line of @task, each ended by a newline (less a trailing carriage return) or by the end of
+ *              the task, scanning it where it lies, and formats their results into @task.results.
+ */
+void run_batch_task(
+        Engine &engine,
+        BatchTask &task
+) {
+  std::vector<const char *> begins, ends;
+  for ( const char *line = task.begin; line < task.end; ) {
+    const char *newline = static_cast<const char *>(std::memchr( line, '\n', task.end - line ));
+    const char *line_end = newline ? newline : task.end;
+    begins.push_back( line );
+    ends.push_back( line_end > line && line_end[ -1 ] == '\r' ? line_end - 1 : line_end );
+    line = newline ? newline + 1 : task.end;
+  }
+  Output output;
 
-  std::sort( state_ids.begin(), state_ids.end() );
+  if ( engine.lanes > 1 ) {
+    std::vector<int32_t> final_dfa_states( begins.size() );
+    dfa_run_interleaved( *engine.automaton, engine.full_dfa, begins.data(), ends.data(), begins.size(), engine.lanes,
+                         final_dfa_states.data() );
 
-  //Create new states (neither start nor accept) where missing.
-  for ( auto current_arg: { begin_state_arg, end_state_arg } ) {
-    if ( !std::binary_search( state_ids.begin(), state_ids.end(), current_arg ) ) {
-      State new_state;
-      new_state.id = current_arg;
-      automaton.states.push_back( new_state );
+    for ( const auto dfa_state : final_dfa_states ) {
+      output.is_accept = false;
+      output.final_states.clear();
+      output_state_set( *engine.automaton, engine.full_dfa.sets[ dfa_state ], output );
+      format_result( *engine.automaton, output, task.results );
     }
-    state_ids.push_back( current_arg );
-    std::sort( state_ids.begin(), state_ids.end() );
+    return;
   }
 
-  //Add transitions to maps
-  for ( auto &current_automaton_state : automaton.states ) {
-    if ( current_automaton_state.id == begin_state_arg ) {
-      current_automaton_state.transitions[ symbol_arg ].push_back( end_state_arg );
-    }
-    state_ids.push_back( current_automaton_state.id );
+  EngineStream stream;
+  for ( size_t line = 0; line < begins.size(); line++ ) {
+    output.is_accept = false;
+    output.final_states.clear();
+    engine_stream_begin( engine, stream );
+    engine_stream_feed( engine, stream, begins[ line ], ends[ line ] );
+    engine_stream_finish( engine, stream, output );
+    format_result( *engine.automaton, output, task.results );
   }
-
 }
 
-
 /*
- * Description: Using data from input file create the desired automaton by specifying states and transitions.
- * Parameters:
- *    @Automaton &automaton                               : A reference to the automaton in main().
- *    @std::vector<std::vector<std::string>> &data_vector : The vector containing the parsed data file (containing the
- *                                                          specifications of the automaton).
+ * Description: Has @thread_count workers check @tasks. Tasks are dealt out largest first, and a worker that runs out
+ *              steals from the others, so a few huge inputs cannot leave cores idle. The lazy DFA is the only engine
+ *              that changes while running, so each worker runs its own copy of it from @engines.
  */
-void create_automaton(
-        Automaton &automaton,
-        std::vector<std::string> &data_vector
+void run_batch_tasks(
+        Engine &engine,
+        std::vector<Engine> &engines,
+        std::vector<BatchTask> &tasks,
+        size_t thread_count
 ) {
-  std::regex state_pattern{ "state" },
-          transition_pattern{ "transition" },
-          transition_function_pattern{ R"(\d\t\w\t\d)" },
-          id_pattern{ "[[:digit:]]+" },
-          start_pattern{ "start" },
-          accept_pattern{ "accept" },
-          start_and_accept_pattern{ R"((start\taccept)|(accept\tstart))" };
-
-  std::smatch matches;
-
-  for ( const std::string &current_line : data_vector ) {
-
-    std::regex_search( current_line, matches, state_pattern );
+  std::vector<BatchTask *> by_cost;
+  for ( auto &task : tasks ) by_cost.push_back( &task );
+  std::stable_sort( by_cost.begin(), by_cost.end(), [](const BatchTask *lhs, const BatchTask *rhs) {
+    return lhs->end - lhs->begin > rhs->end - rhs->begin;
+  } );
+
+  std::vector<WorkerQueue> queues( thread_count );
+  for ( size_t i = 0; i < by_cost.size(); i++ ) queues[ i % thread_count ].tasks.push_back( by_cost[ i ] );
+
+  auto work = [&](size_t worker) {
+    Engine &worker_engine = engine.kind == Engine::lazy ? engines[ worker ] : engine;
+
+    while ( true ) {
+      BatchTask *task = nullptr;
+      for ( size_t i = 0; i < thread_count && !task; i++ ) {
+        WorkerQueue &queue = queues[ ( worker + i ) % thread_count ];
+        std::lock_guard<std::mutex> lock( queue.mutex );
+        if ( queue.tasks.empty() ) continue;
+        if ( i == 0 ) {
+          task = queue.tasks.front();
+          queue.tasks.pop_front();
+        } else {
+          task = queue.tasks.back();
+          queue.tasks.pop_back();
+        }
+      }
+      //No task is ever added while working, so finding every queue empty means the block is done.
+      if ( !task ) return;
+      run_batch_task( worker_engine, *task );
+    }
+  };
 
+  std::vector<std::thread> workers;
+  for ( size_t worker = 1; worker < thread_count; worker++ ) workers.emplace_back( work, worker );
+  work( 0 );
+  for ( auto &worker : workers ) worker.join();
+}
 
-    handle_state_line( automaton, matches, current_line, id_pattern, start_pattern, accept_pattern );
 
+/*
+ * Batch input read from a pipe, handed out a block of whole lines at a time. The unfinished line at the end of each
+ * block is carried over to the front of the next.
+ */
+struct BatchReader {
+    int fd = -1;
+    bool at_end = false;
+    std::string carry;
+};
 
-    std::regex_search( current_line, matches, transition_pattern );
+/*
+ * Description: Reads the next block of at least @block_bytes (unless the input ends first) of whole lines from
+ *              @reader into @block; at the end of the input, the last line need not end with a newline. Returns false
+ *              if reading fails, with errno set.
+ */
+bool read_batch_block(
+        BatchReader &reader,
+        size_t block_bytes,
+        std::vector<char> &block
+) {
+  const size_t read_bytes = size_t( 1 ) << 16;
+  block.assign( reader.carry.begin(), reader.carry.end() );
+  reader.carry.clear();
+
+  //Keep reading until the block is full and holds a newline, so that a line longer than a block still fits in one.
+  //The line carried over has none yet.
+  bool has_newline = false;
+  while ( !reader.at_end && ( block.size() < block_bytes || !has_newline ) ) {
+    const size_t size = block.size();
+    block.resize( size + read_bytes );
+    const ssize_t count = read( reader.fd, block.data() + size, read_bytes );
+    block.resize( size + std::max( ssize_t( 0 ), count ) );
+    if ( count < 0 && errno == EINTR ) continue;
+    if ( count < 0 ) return false;
+    if ( count == 0 ) reader.at_end = true;
+    has_newline = has_newline || ( count > 0 && std::memchr( block.data() + size, '\n', count ) != nullptr );
+  }
 
-    if ( !matches.empty() ) handle_transition_line( automaton, matches, transition_function_pattern, current_line );
+  if ( !reader.at_end ) {
+    size_t line_end = block.size();
+    while ( block[ line_end - 1 ] != '\n' ) line_end--;
+    reader.carry.assign( block.begin() + line_end, block.end() );
+    block.resize( line_end );
   }
+  return true;
 }
 
-
 /*
- * Author: Jacob Berg
- * Date: February 13, 2020 @ 3:40PM
- * Description: After having processed data from input file (i.e. determining all states, whether they are start or
- *              accept, and the outward transitions each possesses, we update the automatons start_state and
- *              accept_states fields for easier access.
+ * Description: Multi-threaded (or interleaved) batch mode for the batch input open as @fd. The input is taken in
+ *              blocks of whole lines, each cut into tasks of about 64 KiB of lines for run_batch_tasks(). A regular
+ *              file is mapped, and its blocks and tasks are ranges of the mapping, so that nothing is copied; a pipe
+ *              is read into two buffers in turn, the next block being read on a thread of its own while the workers
+ *              check the current one. The results of each block are written in input order, also on a thread of
+ *              their own, while the workers go on to the next block. Returns false if reading fails, with errno set.
  */
-void config_start_and_accept_states(Automaton &automaton) {
-  for ( const auto &state: automaton.states ) {
-    if ( state.is_start ) automaton.start_state = state;
-    if ( state.is_accept ) automaton.accept_states.push_back( state );
+bool run_parallel_batch(
+        Engine &engine,
+        int fd,
+        size_t thread_count
+) {
+  const size_t block_bytes = size_t( 64 ) << 20, task_bytes = size_t( 64 ) << 10;
+  MappedFile mapped;
+  const bool is_mapped = map_file( fd, mapped );
+  const char *mapped_end = mapped.data + mapped.size;
+  BatchReader reader;
+  reader.fd = fd;
+  std::vector<char> buffers[ 2 ];
+  std::vector<BatchTask> tasks[ 2 ];
+
+  //Each worker gets its own copy of a lazy DFA.
+  std::vector<Engine> engines( thread_count, engine.kind == Engine::lazy ? engine : Engine() );
+
+  //Finds the block after the one ending at @begin, reading it into buffers[ slot ] unless the input is mapped.
+  auto next_block = [&](size_t slot, const char *&begin, const char *&end) {
+    if ( is_mapped ) {
+      end = line_aligned_end( begin, mapped_end, block_bytes );
+      return true;
+    }
+    if ( !read_batch_block( reader, block_bytes, buffers[ slot ] ) ) return false;
+    begin = buffers[ slot ].data();
+    end = begin + buffers[ slot ].size();
+    return true;
+  };
+
+  const char *begin = mapped.data, *end = mapped.data;
+  bool read_ok = next_block( 0, begin, end );
+  std::thread writer;
+
+  for ( size_t slot = 0; read_ok && begin != end; slot ^= 1 ) {
+    const char *next_begin = end, *next_end = end;
+    bool next_ok = true;
+    std::thread next_reader;
+    if ( is_mapped ) next_ok = next_block( slot ^ 1, next_begin, next_end );
+    else next_reader = std::thread( [&, slot] { next_ok = next_block( slot ^ 1, next_begin, next_end ); } );
+
+    tasks[ slot ].clear();
+    for ( const char *task_begin = begin; task_begin != end; ) {
+      BatchTask task;
+      task.begin = task_begin;
+      task.end = task_begin = line_aligned_end( task_begin, end, task_bytes );
+      tasks[ slot ].push_back( std::move( task ) );
+    }
+    run_batch_tasks( engine, engines, tasks[ slot ], thread_count );
+
+    //The previous block's results are out before this one's start; its tasks are then free for the next block.
+    if ( writer.joinable() ) writer.join();
+    writer = std::thread( [&tasks, slot] {
+      for ( const auto &task : tasks[ slot ] ) fwrite( task.results.data(), 1, task.results.size(), stdout );
+    } );
+
+    if ( next_reader.joinable() ) next_reader.join();
+    begin = next_begin;
+    end = next_end;
+    read_ok = next_ok;
   }
+
+  if ( writer.joinable() ) writer.join();
+  unmap_file( mapped );
+  fflush( stdout );
+  return read_ok;
 }
 
-void process_configuration_sequence(
-        const std::vector<State> &automaton_states,
-        State &current_state,
-        const std::string &input_string,
+
+/*
+ * Description: Streaming mode: checks everything read from @fd, up to end of file, as one input string against
+ *              @engine, filling @output. The input is read in fixed-size pieces and only the engine's frontier or DFA
+ *              state is kept between them, so memory use does not grow with the input. A final "\n" or "\r\n" is
+ *              not part of the input, which needs the trailing line-break bytes of each piece held back until it
+ *              is known whether more follows. Returns false if reading fails, with errno set.
+ */
+bool run_stream(
+        Engine &engine,
+        int fd,
         Output &output
 ) {
+  const size_t read_bytes = size_t( 1 ) << 16;
+  std::vector<char> buffer( read_bytes + 2 );
+  size_t held = 0;                        // Line-break bytes at the front of buffer, held back from the last piece.
+  EngineStream stream;
+
+  //Pipes cannot take the hint; files get a larger kernel readahead window.
+  posix_fadvise( fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+  engine_stream_begin( engine, stream );
+  while ( true ) {
+    const ssize_t count = read( fd, buffer.data() + held, read_bytes );
+    if ( count < 0 && errno == EINTR ) continue;
+    if ( count < 0 ) return false;
+    if ( count == 0 ) break;
+
+    const char *begin = buffer.data(), *end = buffer.data() + held + count;
+    size_t trailing = 0;
+    while ( trailing < 2 && end - trailing > begin && ( end[ -1 - trailing ] == '\n' || end[ -1 - trailing ] == '\r' ) )
+      trailing++;
+    engine_stream_feed( engine, stream, begin, end - trailing );
+    std::memmove( buffer.data(), end - trailing, trailing );
+    held = trailing;
+  }
 
-  std::vector<State> endpoints;
-  std::string input_string_cpy;
-
-  if ( input_string.empty() ) {
-    output.final_states.push_back( current_state.id );
-    if ( current_state.is_accept ) output.is_accept = true;
-    return;
+  //Whatever is still held back ends the input, less its final line break.
+  if ( held > 0 && buffer[ held - 1 ] == '\n' ) {
+    held--;
+    if ( held > 0 && buffer[ held - 1 ] == '\r' ) held--;
   }
+  engine_stream_feed( engine, stream, buffer.data(), buffer.data() + held );
+  engine_stream_finish( engine, stream, output );
+  return true;
+}
 
-  auto itr = current_state.transitions.find( std::string( 1, input_string.front() ) );
 
-  for ( const auto &state : automaton_states ) {
-    for ( const auto &transition_endpoint : itr->second ) {
+/*
+ * Description: Writes @text to @out as the body of a C++ string literal.
+ */
+void write_string_literal(std::ostream &out, const std::string &text) {
+  out << '"';
+  for ( const char c : text ) {
+    if ( c == '\t' ) out << "\\t";
+    else if ( c == '\n' ) out << "\\n";
+    else if ( c == '"' || c == '\\' ) out << '\\' << c;
+    else out << c;
+  }
+  out << '"';
+}
 
-      if ( transition_endpoint == state.id ) {
-        endpoints.push_back( state );
-        break;
+/*
+ * Description: Code generation mode: writes to @out a standalone C++ source file that implements the DFA of
+ *              @compiled (exactly minimized, unless --minimize asks otherwise) as straight-line code. Every DFA state
+ *              is a label whose switch on the next byte jumps directly to the next state's label, so a run does no
+ *              table lookups; a state that every byte leaves unchanged returns at once. Each state's result line is
+ *              a string constant, so the generated file can report exactly what this program would print.
+ * Parameters:
+ *    @const CompiledAutomaton &compiled      : The compiled automaton.
+ *    @Options options                        : The --max-dfa-states, --minimize and --verbose settings.
+ *    @const std::string &spec_name           : The specification it was generated from, for the header comment.
+ *    @const std::string &name                : The namespace of the generated code; must be an identifier.
+ *    @std::ostream &out                      : Receives the source file.
+ */
+void generate_code(
+        const CompiledAutomaton &compiled,
+        Options options,
+        const std::string &spec_name,
+        const std::string &name,
+        std::ostream &out
+) {
+  if ( options.minimize.empty() ) options.minimize = "exact";
+  Dfa dfa;
+  std::string error;
+  if ( !build_dfa( compiled, options, dfa, error ) ) halt_with_error( error );
+  const int state_count = static_cast<int>(dfa.sets.size());
+
+  out << "/*\n"
+      << " * Generated by fsa-codegen from " << spec_name << ": a DFA of " << state_count << " states. Do not edit;\n"
+      << " * generate it again from the specification instead.\n"
+      << " *\n"
+      << " * " << name << "::match( data, size ) runs the automaton over an input and returns the DFA state it ends\n"
+      << " * in; accepting[ state ] tells whether that state accepts and results[ state ] is the line the simulator\n"
+      << " * prints for it. Define FSA_GENERATED_MAIN to also compile a main() that checks its first argument.\n"
+      << " */\n"
+      << "#include <cstddef>\n\n"
+      << "namespace " << name << " {\n\n"
+      << "const int state_count = " << state_count << ";\n"
+      << "const int start_state = " << dfa.start << ";\n\n";
+
+  out << "const bool accepting[ state_count ] = {";
+  for ( int state = 0; state < state_count; state++ )
+    out << ( state % 16 ? " " : "\n    " ) << ( dfa.accepting[ state ] ? "true," : "false," );
+  out << "\n};\n\n";
+
+  out << "const char *const results[ state_count ] = {\n";
+  for ( int state = 0; state < state_count; state++ ) {
+    Output output;
+    std::string line;
+    output_state_set( compiled, dfa.sets[ state ], output );
+    format_result( compiled, output, line );
+    out << "    ";
+    write_string_literal( out, line );
+    out << ",\n";
+  }
+  out << "};\n\n";
+
+  out << "inline int match(const char *data, std::size_t size) {\n"
+      << "  const unsigned char *p = reinterpret_cast<const unsigned char *>(data), *end = p + size;\n"
+      << "  goto s" << dfa.start << ";\n";
+
+  for ( int state = 0; state < state_count; state++ ) {
+    const int32_t *row = &dfa.table[ static_cast<size_t>(state) * dfa.class_count ];
+    std::vector<int> byte_target( 256 ), uses( state_count, 0 );
+    for ( int byte = 0; byte < 256; byte++ ) uses[ byte_target[ byte ] = row[ compiled.byte_class[ byte ] ] ]++;
+    const int fallback = static_cast<int>(std::max_element( uses.begin(), uses.end() ) - uses.begin());
+
+    out << "s" << state << ":\n";
+    if ( uses[ state ] == 256 ) {
+      out << "  return " << state << ";\n";
+      continue;
+    }
+    out << "  if ( p == end ) return " << state << ";\n"
+        << "  switch ( *p++ ) {\n";
+    for ( int target = 0; target < state_count; target++ ) {
+      if ( target == fallback || !uses[ target ] ) continue;
+      out << "   ";
+      for ( int byte = 0; byte < 256; byte++ ) {
+        if ( byte_target[ byte ] != target ) continue;
+        if ( isalnum( byte ) ) out << " case '" << static_cast<char>(byte) << "':";
+        else out << " case " << byte << ":";
       }
-
+      out << " goto s" << target << ";\n";
     }
+    out << "    default: goto s" << fallback << ";\n"
+        << "  }\n";
   }
-  input_string_cpy = input_string.substr( 1, input_string.length() );
-  for ( auto &state : endpoints )
-    process_configuration_sequence(
-            automaton_states,
-            state,
-            input_string_cpy,
-            output
-    );
+  out << "}\n\n"
+      << "}  // namespace " << name << "\n\n";
+
+  out << "#ifdef FSA_GENERATED_MAIN\n"
+      << "#include <cstdio>\n"
+      << "#include <cstring>\n\n"
+      << "int main(int argc, char *argv[]) {\n"
+      << "  if ( argc != 2 ) {\n"
+      << "    fprintf( stderr, \"Usage:\\t %s automaton_config_string\\n\", argv[ 0 ] );\n"
+      << "    return 1;\n"
+      << "  }\n"
+      << "  fputs( " << name << "::results[ " << name << "::match( argv[ 1 ], strlen( argv[ 1 ] ) ) ], stdout );\n"
+      << "  return 0;\n"
+      << "}\n"
+      << "#endif\n";
+}
 
 
+/*
+ * Description: Checks the single input [@begin, @end) against @engine, filling @output. With --threads, the dfa and
+ *              matrix engines split the input across threads; every other engine scans it in place.
+ */
+void run_input(
+        Engine &engine,
+        const Options &options,
+        const char *begin,
+        const char *end,
+        Output &output
+) {
+  const CompiledAutomaton &compiled = *engine.automaton;
+
+  if ( engine.kind == Engine::dfa && options.threads > 1 ) {
+    dfa_run_parallel( compiled, engine.full_dfa, begin, end, options.threads, output );
+  } else if ( engine.kind == Engine::matrix ) {
+    nfa_run_matrix( compiled, begin, end, options.threads, output );
+  } else {
+    EngineStream stream;
+    engine_stream_begin( engine, stream );
+    engine_stream_feed( engine, stream, begin, end );
+    engine_stream_finish( engine, stream, output );
+  }
 }
 
+
 int main(int argc, char* argv[]) {
 
   static Automaton automaton;
   Output output;
-  std::vector<std::string> data_vector;
-
-  if ( argc != 3 ) {
+  Options options;
+  std::vector<std::string> arguments;
+
+  select_simd_kernels( options.simd );
+  parse_options( argc, argv, options, arguments );
+
+#ifdef FSA_CODEGEN
+  //The fsa-codegen build of this program only generates code, so its arguments are those of the codegen command.
+  arguments.insert( arguments.begin(), "codegen" );
+#endif
+
+  const bool compile_only = arguments.size() == 3 && arguments[ 0 ] == "compile";
+  const bool codegen_only = arguments.size() == 3 && arguments[ 0 ] == "codegen";
+  const size_t expected_arguments = options.batch.empty() && options.input.empty() ? 2 : 1;
+  if ( !compile_only && !codegen_only && ( arguments.size() != expected_arguments ||
+                                           ( !options.batch.empty() && !options.input.empty() ) ) ) {
     std::cerr << "Error:\t Three arguments were not detected." << "\n"
               << "Arguments detected were" << "\n";
     for ( int i = 0; i < argc; i++ ) {
       std::cout << argv[ i ] << "\n";
     }
-    std::cout << "Usage:\t this_file_name\t automaton_specs.txt\tautomaton_config_string" << "\n"
-              << "Halting with exit code 1." << "\n";
+    print_usage();
+    std::cout << "Halting with exit code 1." << "\n";
 
     exit( 1 );
   }
 
-  const std::string in_file_handle = argv[ 1 ];
-  const auto input_string = new std::string( argv[ 2 ] );
-
-  parse_file( in_file_handle, data_vector );
-  create_automaton( automaton, data_vector );
-  config_start_and_accept_states( automaton );
-  process_configuration_sequence(
-          automaton.states,
-          automaton.start_state,
-          *input_string,
-          output
-  );
+  const std::string in_file_handle = arguments[ compile_only || codegen_only ? 1 : 0 ];
+  CompiledAutomaton compiled;
+  std::string error;
 
-  std::sort( output.final_states.begin(), output.final_states.end() );
-  auto itr = std::unique( output.final_states.begin(), output.final_states.end() );
-  output.final_states.resize(
-          static_cast<unsigned long>(std::distance( output.final_states.begin(), itr ))
-  );
+  if ( !load_compiled( in_file_handle, compiled, error ) ) {
+    if ( !error.empty() ) halt_with_error( error );
+    if ( !parse_file( in_file_handle, options.threads, automaton, error ) ) halt_with_error( error );
+    config_start_and_accept_states( automaton );
+    if ( !compile_automaton( automaton, compiled, error ) ) halt_with_error( error );
+  }
+
+  if ( compile_only ) {
+    if ( !write_compiled( compiled, arguments[ 2 ] ) ) {
+      std::cerr << "Failure in writing " << arguments[ 2 ] << ": " << strerror( errno ) << "\n"
+                << "Halting with exit code 1." << "\n";
+      exit( 1 );
+    }
+    return 0;
+  }
 
-  if ( output.is_accept ) {
-    std::cout << "accept\t";
+  if ( codegen_only ) {
+    //The generated namespace is named after the output file, e.g. fsa_protocol_dfa for protocol_dfa.cpp. The prefix
+    //keeps it an identifier that is never a keyword (new.cpp) nor starts with a digit (2fa.cpp).
+    const std::string &out_file_name = arguments[ 2 ];
+    const size_t slash = out_file_name.find_last_of( '/' );
+    std::string name = out_file_name.substr( slash == std::string::npos ? 0 : slash + 1 );
+    name = name.substr( 0, name.find( '.' ) );
+    for ( auto &c : name ) if ( !isalnum( static_cast<unsigned char>(c) ) ) c = '_';
+    name = "fsa_" + name;
+
+    std::ofstream out_file( out_file_name );
+    generate_code( compiled, options, in_file_handle, name, out_file );
+    out_file.close();
+    if ( !out_file ) {
+      std::cerr << "Failure in writing " << out_file_name << "\n"
+                << "Halting with exit code 1." << "\n";
+      exit( 1 );
+    }
+    return 0;
+  }
 
-    for ( const auto &final_state_id : output.final_states ) {
-      for ( const auto &automaton_accept_state : automaton.accept_states ) {
-        if ( final_state_id == automaton_accept_state.id ) {
-          std::cout << final_state_id << " ";
-          break;
-        }
+  Engine engine;
+  if ( !make_engine( compiled, options, engine, error ) ) halt_with_error( error );
+
+  if ( !options.batch.empty() ) {
+    std::ios::sync_with_stdio( false );
+    if ( options.threads > 1 || engine.lanes > 1 ) {
+      const int fd = options.batch == "-" ? STDIN_FILENO : open( options.batch.c_str(), O_RDONLY );
+      if ( fd < 0 || !run_parallel_batch( engine, fd, options.threads ) )
+        halt_with_error( "Failure in reading " + options.batch + ": " + strerror( errno ) );
+      if ( fd != STDIN_FILENO ) close( fd );
+      return 0;
+    }
+
+    std::ifstream batch_file;
+    if ( options.batch != "-" ) {
+      batch_file.open( options.batch );
+      if ( !batch_file ) {
+        std::cerr << "Failure in opening file." << "\n"
+                  << "Halting with exit code 1." << "\n";
+        exit( 1 );
       }
     }
-  } else {
-    std::cout << "reject\t";
-    for ( const auto &final_state_id : output.final_states ) std::cout << final_state_id << " ";
+
+    run_batch( engine, options.batch == "-" ? std::cin : batch_file );
+    return 0;
   }
 
-  std::cout << "\n";
+  std::string line;
+
+  if ( !options.input.empty() ) {
+    const int fd = options.input == "-" ? STDIN_FILENO : open( options.input.c_str(), O_RDONLY );
+    MappedFile mapped;
+
+    if ( fd >= 0 && map_file( fd, mapped ) ) {
+      const char *begin = mapped.data, *end = mapped.data + mapped.size;
+      if ( end > begin && end[ -1 ] == '\n' ) {
+        end--;
+        if ( end > begin && end[ -1 ] == '\r' ) end--;
+      }
+      run_input( engine, options, begin, end, output );
+      unmap_file( mapped );
+    } else if ( fd < 0 || !run_stream( engine, fd, output ) ) {
+      std::cerr << "Failure in reading " << options.input << ": " << strerror( errno ) << "\n"
+                << "Halting with exit code 1." << "\n";
+      exit( 1 );
+    }
+    if ( fd != STDIN_FILENO ) close( fd );
+    format_result( compiled, output, line );
+    std::cout << line;
+    return 0;
+  }
+
+  const std::string &input_string = arguments[ 1 ];
+
+  run_input( engine, options, input_string.data(), input_string.data() + input_string.size(), output );
+  format_result( compiled, output, line );
+  std::cout << line;
 
   return 0;
 }
-
@@ -0,0 +1,89 @@
+/*
+ * Description: Compile-time checks of fsa::static_automaton. Nothing here runs: every check is a static_assert, so a
+ *              regression in the constexpr parser, determinizer or minimizer fails the build. The expected results
+ *              are those the simulator prints for the same specifications and inputs.
+ */
+
+#include "static_automaton.h"
+
+namespace {
+
+//The example of static_automaton.h: accepts the strings with an even number of 1s.
+struct Parity {
+    static constexpr std::string_view text = "state\t0\tstart\taccept\n"
+                                             "transition\t0\t1\t1\n"
+                                             "transition\t1\t1\t0\n"
+                                             "transition\t0\t0\t0\n"
+                                             "transition\t1\t0\t1\n";
+};
+
+typedef fsa::static_automaton<Parity> ParityAutomaton;
+
+static_assert( ParityAutomaton::accepts( "" ) );
+static_assert( ParityAutomaton::accepts( "0110" ) );
+static_assert( ParityAutomaton::accepts( "000" ) );
+static_assert( !ParityAutomaton::accepts( "1" ) );
+static_assert( !ParityAutomaton::accepts( "0111" ) );
+static_assert( !ParityAutomaton::accepts( "0120" ) );  // A byte outside the alphabet rejects.
+static_assert( ParityAutomaton::run( "11" ) == ParityAutomaton::start_state );
+
+//input1.dat: accepts once three 1s have been read.
+struct CountOnes {
+    static constexpr std::string_view text = "state\t1\tstart\nstate\t4\taccept\nstate\t5\taccept\nstate\t6\taccept\n"
+                                             "transition\t1\t0\t1\ntransition\t2\t0\t2\ntransition\t3\t0\t3\n"
+                                             "transition\t4\t0\t4\ntransition\t4\t1\t4\ntransition\t5\t0\t5\n"
+                                             "transition\t5\t1\t5\ntransition\t6\t0\t6\ntransition\t6\t1\t6\n"
+                                             "transition\t1\t1\t2\ntransition\t2\t1\t3\ntransition\t3\t1\t4\n"
+                                             "transition\t4\t1\t5\ntransition\t5\t1\t6\ntransition\t4\t0\t5\n"
+                                             "transition\t5\t0\t6\n";
+};
+
+typedef fsa::static_automaton<CountOnes> CountOnesAutomaton;
+
+static_assert( !CountOnesAutomaton::accepts( "" ) );
+static_assert( !CountOnesAutomaton::accepts( "0110" ) );
+static_assert( CountOnesAutomaton::accepts( "0111" ) );
+static_assert( CountOnesAutomaton::accepts( "10101000" ) );
+static_assert( !CountOnesAutomaton::accepts( "1112" ) );
+
+//input4.dat: epsilon-transitions, both as ε and as epsilon, and a CRLF line ending.
+struct Epsilon {
+    static constexpr std::string_view text = "state\t1\tstart\r\n"
+                                             "state\t5\taccept\n"
+                                             "transition\t1\tε\t2\n"
+                                             "transition\t2\tepsilon\t3\n"
+                                             "transition\t3\tε\t1\n"
+                                             "transition\t2\t0\t4\n"
+                                             "transition\t3\t1\t4\n"
+                                             "transition\t4\tε\t5\n"
+                                             "transition\t5\t0\t1\n"
+                                             "transition\t5\t1\t5\n";
+};
+
+typedef fsa::static_automaton<Epsilon> EpsilonAutomaton;
+
+static_assert( !EpsilonAutomaton::accepts( "" ) );
+static_assert( EpsilonAutomaton::accepts( "0" ) );
+static_assert( EpsilonAutomaton::accepts( "1" ) );
+static_assert( !EpsilonAutomaton::accepts( "00" ) );
+static_assert( EpsilonAutomaton::accepts( "01" ) );
+static_assert( !EpsilonAutomaton::accepts( "10" ) );
+static_assert( !EpsilonAutomaton::accepts( "0110" ) );
+static_assert( EpsilonAutomaton::accepts( "0101" ) );
+static_assert( EpsilonAutomaton::accepts( "1111" ) );
+static_assert( !EpsilonAutomaton::accepts( "012" ) );
+
+//State ids reach the ends of int, as in the simulator.
+struct ExtremeIds {
+    static constexpr std::string_view text = "state\t-2147483648\tstart\n"
+                                             "state\t2147483647\taccept\n"
+                                             "transition\t-2147483648\ta\t2147483647\n";
+};
+
+typedef fsa::static_automaton<ExtremeIds> ExtremeIdsAutomaton;
+
+static_assert( ExtremeIdsAutomaton::accepts( "a" ) );
+static_assert( !ExtremeIdsAutomaton::accepts( "" ) );
+static_assert( !ExtremeIdsAutomaton::accepts( "aa" ) );
+
+}  // namespace